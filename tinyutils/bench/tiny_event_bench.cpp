@@ -0,0 +1,317 @@
+// tiny_event_bench.cpp : tiny::EventCenter under load: socketpair ping-pong round trips
+// through a FileEventCenter (epoll, epoll + busy poll, io_uring), timer arm/cancel and
+// firing lateness, and N producers submit_to'ing into one loop.
+//
+// usage: tiny_event_bench [rounds] [max_producers]
+//
+
+#include "tiny_event_center.h"
+#include "tiny_socket.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <unistd.h>
+
+using bench_clock = std::chrono::steady_clock;
+
+static uint64_t elapsed_ns(bench_clock::time_point begin)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - begin).count();
+}
+
+struct Percentiles
+{
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+};
+
+static Percentiles percentiles(std::vector<uint64_t>& v)
+{
+	std::sort(v.begin(), v.end());
+	Percentiles p;
+	p.p50 = v[v.size() / 2];
+	p.p99 = v[v.size() * 99 / 100];
+	p.p999 = v[v.size() * 999 / 1000];
+	return p;
+}
+
+/*
+*	class BenchLoop
+*
+*	A FileEventCenter running on its own thread until stopped.
+*/
+class BenchLoop
+{
+public:
+	explicit BenchLoop(bool use_uring = false, unsigned busy_poll = 0)
+		: center_(5000, use_uring)
+		, stop_(false)
+		, ready_(false)
+	{
+		thread_ = std::thread([this, busy_poll] {
+			center_.set_owner();
+			center_.set_busy_poll(busy_poll);
+			ready_.store(true);
+			while (!stop_.load(std::memory_order_relaxed))
+			{
+				center_.process_events(30000000);
+			}
+			center_.unset_owner();
+		});
+		while (!ready_.load())
+		{
+			std::this_thread::yield();
+		}
+	}
+	~BenchLoop()
+	{
+		center_.submit_to([this] { stop_.store(true); }, true);
+		thread_.join();
+	}
+	tiny::FileEventCenter& center() { return center_; }
+private:
+	tiny::FileEventCenter center_;
+	std::atomic_bool stop_;
+	std::atomic_bool ready_;
+	std::thread thread_;
+};
+
+/*
+*	class C_echo
+*
+*	Writes back what it reads.
+*/
+class C_echo : public tiny::EventCallback
+{
+public:
+	void do_request(uint64_t fd) override
+	{
+		char buf[64];
+		ssize_t n = ::read((int)fd, buf, sizeof(buf));
+		if (n > 0)
+		{
+			ssize_t r = ::write((int)fd, buf, (size_t)n);
+			(void)r;
+		}
+	}
+};
+
+static void bench_ping_pong(size_t rounds)
+{
+	printf("\nping-pong: one byte over a socketpair, echoed by the loop, %zu rounds\n", rounds);
+	printf("%-14s %12s %8s %8s %8s\n", "driver", "rounds/sec", "p50 ns", "p99 ns", "p999 ns");
+	struct Mode { const char* name; bool uring; unsigned busy_poll; };
+	const Mode modes[] = { { "epoll", false, 0 }, { "epoll+busy", false, 200 }, { "io_uring", true, 0 } };
+	for (const Mode& mode : modes)
+	{
+		if (mode.busy_poll && std::thread::hardware_concurrency() < 2)
+		{
+			// the spinning loop would only starve the client of the one cpu
+			printf("%-14s %12s\n", mode.name, "skipped, 1 cpu");
+			continue;
+		}
+		int fds[2];
+		if (create_socketpair(fds, SOCK_STREAM) != 0)
+		{
+			printf("create_socketpair failed\n");
+			return;
+		}
+		C_echo echo;
+		std::vector<uint64_t> rtt;
+		rtt.reserve(rounds);
+		{
+			BenchLoop loop(mode.uring, mode.busy_poll);
+			loop.center().submit_to([&] { loop.center().create_file_event(fds[0], EVENT_READABLE, &echo); });
+			char c = 'x';
+			auto begin = bench_clock::now();
+			for (size_t i = 0; i < rounds; ++i)
+			{
+				auto s = bench_clock::now();
+				if (::write(fds[1], &c, 1) != 1 || ::read(fds[1], &c, 1) != 1)
+				{
+					printf("socketpair io failed\n");
+					break;
+				}
+				rtt.push_back(elapsed_ns(s));
+			}
+			double secs = elapsed_ns(begin) / 1e9;
+			loop.center().submit_to([&] { loop.center().delete_file_event(fds[0], EVENT_READABLE); });
+			if (!rtt.empty())
+			{
+				double rate = rtt.size() / secs;
+				Percentiles p = percentiles(rtt);
+				printf("%-14s %12.0f %8llu %8llu %8llu\n", mode.name, rate,
+					(unsigned long long)p.p50, (unsigned long long)p.p99, (unsigned long long)p.p999);
+			}
+		}
+		::close(fds[0]);
+		::close(fds[1]);
+	}
+}
+
+/*
+*	class C_fired
+*
+*	Records how late a time event fired.
+*/
+class C_fired : public tiny::EventCallback
+{
+public:
+	C_fired() : late(nullptr) {}
+	void do_request(uint64_t id) override
+	{
+		late->push_back(elapsed_ns(due));
+	}
+	bench_clock::time_point due;
+	std::vector<uint64_t>* late;
+};
+
+static void bench_timers(size_t timers)
+{
+	printf("\ntimers: %zu time events at random 1us..1s delays\n", timers);
+	printf("%-14s %12s %8s %8s %8s\n", "op", "ops/sec", "p50 ns", "p99 ns", "p999 ns");
+	BenchLoop loop;
+	tiny::FileEventCenter& center = loop.center();
+	C_fired never;
+	std::vector<uint64_t> ids(timers);
+	std::vector<uint64_t> arm_ns(timers);
+	std::vector<uint64_t> cancel_ns(timers);
+	double arm_secs = 0;
+	double cancel_secs = 0;
+	center.submit_to([&] {
+		std::mt19937 rng(7);
+		auto begin = bench_clock::now();
+		for (size_t i = 0; i < timers; ++i)
+		{
+			auto s = bench_clock::now();
+			ids[i] = center.create_time_event(1 + rng() % 1000000, &never);
+			arm_ns[i] = elapsed_ns(s);
+		}
+		arm_secs = elapsed_ns(begin) / 1e9;
+		std::shuffle(ids.begin(), ids.end(), rng);
+		begin = bench_clock::now();
+		for (size_t i = 0; i < timers; ++i)
+		{
+			auto s = bench_clock::now();
+			center.delete_time_event(ids[i]);
+			cancel_ns[i] = elapsed_ns(s);
+		}
+		cancel_secs = elapsed_ns(begin) / 1e9;
+	});
+	Percentiles p = percentiles(arm_ns);
+	printf("%-14s %12.0f %8llu %8llu %8llu\n", "arm", timers / arm_secs,
+		(unsigned long long)p.p50, (unsigned long long)p.p99, (unsigned long long)p.p999);
+	p = percentiles(cancel_ns);
+	printf("%-14s %12.0f %8llu %8llu %8llu\n", "cancel", timers / cancel_secs,
+		(unsigned long long)p.p50, (unsigned long long)p.p99, (unsigned long long)p.p999);
+
+	// lateness of timers that do fire, against a 1ms tick
+	const size_t firing = std::min<size_t>(timers, 20000);
+	std::vector<C_fired> fired(firing);
+	std::vector<uint64_t> late;
+	late.reserve(firing);
+	center.submit_to([&] {
+		std::mt19937 rng(11);
+		for (C_fired& f : fired)
+		{
+			uint64_t us = 1000 + rng() % 100000;
+			f.late = &late;
+			f.due = bench_clock::now() + std::chrono::microseconds(us);
+			center.create_time_event(us, &f);
+		}
+	});
+	size_t done = 0;
+	while (done < firing)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		center.submit_to([&] { done = late.size(); });
+	}
+	p = percentiles(late);
+	printf("%-14s %12s %8llu %8llu %8llu\n", "fire lateness", "-",
+		(unsigned long long)p.p50, (unsigned long long)p.p99, (unsigned long long)p.p999);
+}
+
+static void bench_submit(size_t max_producers, size_t per_producer)
+{
+	printf("\nsubmit_to: N producers into one loop, %zu async submits each, then sync round trips\n", per_producer);
+	printf("%-10s %14s %10s %10s %10s\n", "producers", "async ops/sec", "sync p50", "sync p99", "sync p999");
+	for (size_t producers = 1; producers <= max_producers; producers *= 2)
+	{
+		BenchLoop loop;
+		tiny::FileEventCenter& center = loop.center();
+		uint64_t ran = 0;							// loop thread only
+		std::vector<std::vector<uint64_t>> sync_ns(producers);
+		std::vector<std::thread> threads;
+		auto begin = bench_clock::now();
+		for (size_t t = 0; t < producers; ++t)
+		{
+			threads.emplace_back([&, t] {
+				for (size_t i = 0; i < per_producer; ++i)
+				{
+					center.submit_to([&ran] { ++ran; }, true);
+				}
+			});
+		}
+		for (std::thread& t : threads)
+		{
+			t.join();
+		}
+		threads.clear();
+		uint64_t seen = 0;
+		while (seen < producers * per_producer)
+		{
+			center.submit_to([&] { seen = ran; });
+		}
+		double secs = elapsed_ns(begin) / 1e9;
+
+		const size_t sync_rounds = std::max<size_t>(per_producer / 20, 1000);
+		for (size_t t = 0; t < producers; ++t)
+		{
+			threads.emplace_back([&, t] {
+				std::vector<uint64_t>& lat = sync_ns[t];
+				lat.reserve(sync_rounds);
+				for (size_t i = 0; i < sync_rounds; ++i)
+				{
+					auto s = bench_clock::now();
+					center.submit_to([&ran] { ++ran; });
+					lat.push_back(elapsed_ns(s));
+				}
+			});
+		}
+		for (std::thread& t : threads)
+		{
+			t.join();
+		}
+		std::vector<uint64_t> all;
+		for (std::vector<uint64_t>& lat : sync_ns)
+		{
+			all.insert(all.end(), lat.begin(), lat.end());
+		}
+		Percentiles p = percentiles(all);
+		printf("%-10zu %14.0f %10llu %10llu %10llu\n", producers, producers * per_producer / secs,
+			(unsigned long long)p.p50, (unsigned long long)p.p99, (unsigned long long)p.p999);
+		if (producers < max_producers && producers * 2 > max_producers)
+		{
+			producers = max_producers / 2;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t rounds = 100000;
+	size_t max_producers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), 8);
+	if (argc > 1)
+	{
+		rounds = std::max(1, atoi(argv[1]));
+	}
+	if (argc > 2)
+	{
+		max_producers = std::max(1, atoi(argv[2]));
+	}
+	bench_ping_pong(rounds);
+	bench_timers(rounds * 10);
+	bench_submit(max_producers, rounds * 10);
+	return 0;
+}
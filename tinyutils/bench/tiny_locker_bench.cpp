@@ -0,0 +1,157 @@
+// tiny_locker_bench.cpp : tiny::spinlock (TTAS), ticket_lock, mcs_lock and an atomic_flag
+// test-and-set lock against std::mutex, 1..N threads hammering one lock for a fixed time.
+// Reports total acquisitions/sec and fairness, the least over the most acquisitions of a
+// thread (1.0 is perfectly fair).
+//
+// usage: tiny_locker_bench [max_threads] [milliseconds]
+//
+
+#include "tiny_locker.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+/*
+*	struct Shared
+*
+*	What the critical section touches: a counter and a few more cache lines.
+*/
+struct Shared
+{
+	uint64_t counter = 0;
+	uint64_t lines[4][8] = {};
+
+	void update()
+	{
+		++counter;
+		for (int i = 0; i < 4; ++i)
+		{
+			lines[i][0] += counter;
+		}
+	}
+};
+
+// bare test-and-set without backoff, what the others are measured against
+struct TasLock
+{
+	std::atomic_flag af = ATOMIC_FLAG_INIT;
+	void lock() { while (af.test_and_set(std::memory_order_acquire)); }
+	void unlock() { af.clear(std::memory_order_release); }
+};
+
+struct McsLock
+{
+	tiny::mcs_lock lock;
+};
+
+template<typename L>
+static void critical(L& lock, Shared& shared)
+{
+	std::lock_guard<L> l(lock);
+	shared.update();
+}
+
+static void critical(McsLock& lock, Shared& shared)
+{
+	tiny::mcs_lock::guard g(lock.lock);
+	shared.update();
+}
+
+struct RunResult
+{
+	double ops_per_sec;
+	double fairness;
+};
+
+template<typename L>
+static RunResult run(size_t threads, int milliseconds)
+{
+	L lock;
+	Shared shared;
+	std::atomic_bool go(false);
+	std::atomic_bool stop(false);
+	std::vector<uint64_t> ops(threads * 8);				// a cache line per thread
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; ++t)
+	{
+		workers.emplace_back([&, t] {
+			while (!go.load())
+			{
+				std::this_thread::yield();
+			}
+			uint64_t n = 0;
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				critical(lock, shared);
+				++n;
+			}
+			ops[t * 8] = n;
+		});
+	}
+	auto begin = std::chrono::steady_clock::now();
+	go.store(true);
+	std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+	stop.store(true);
+	for (std::thread& w : workers)
+	{
+		w.join();
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	uint64_t total = 0;
+	uint64_t least = UINT64_MAX;
+	uint64_t most = 0;
+	for (size_t t = 0; t < threads; ++t)
+	{
+		total += ops[t * 8];
+		least = std::min(least, ops[t * 8]);
+		most = std::max(most, ops[t * 8]);
+	}
+	if (total != shared.counter)
+	{
+		printf("lost updates: %llu != %llu\n", (unsigned long long)total, (unsigned long long)shared.counter);
+	}
+	RunResult r;
+	r.ops_per_sec = total / secs;
+	r.fairness = (most ? (double)least / most : 0);
+	return r;
+}
+
+int main(int argc, char** argv)
+{
+	size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+	int milliseconds = 300;
+	if (argc > 1)
+	{
+		max_threads = std::max(1, atoi(argv[1]));
+	}
+	if (argc > 2)
+	{
+		milliseconds = std::max(1, atoi(argv[2]));
+	}
+
+	printf("%zu hardware threads, %d ms per run; ops/sec (fairness)\n", (size_t)std::thread::hardware_concurrency(), milliseconds);
+	printf("%7s %22s %22s %22s %22s %22s\n", "threads", "std::mutex", "spinlock (ttas)", "ticket_lock", "mcs_lock", "atomic_flag tas");
+	for (size_t threads = 1; threads <= max_threads; threads *= 2)
+	{
+		RunResult r[5] = {
+			run<std::mutex>(threads, milliseconds),
+			run<tiny::spinlock>(threads, milliseconds),
+			run<tiny::ticket_lock>(threads, milliseconds),
+			run<McsLock>(threads, milliseconds),
+			run<TasLock>(threads, milliseconds),
+		};
+		printf("%7zu", threads);
+		for (const RunResult& x : r)
+		{
+			printf(" %14.0f (%4.2f)", x.ops_per_sec, x.fairness);
+		}
+		printf("\n");
+		if (threads < max_threads && threads * 2 > max_threads)
+		{
+			threads = max_threads / 2;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,63 @@
+// tiny_log_header_bench.cpp : log line header formatting, utime_t::snprintf_t + snprintf
+// against tiny::LogHeaderFormatter.
+//
+
+#include "tiny_logger.h"
+#include <chrono>
+
+static const size_t ENTRIES = 2000000;
+
+template<typename F>
+static double entries_per_sec(F&& f)
+{
+	auto begin = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < ENTRIES; ++i)
+	{
+		f(i);
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	return ENTRIES / secs;
+}
+
+int main()
+{
+	const std::string name = "tiny_sqlite3";
+	const unsigned long thread = tiny::Thread::posix_this_thread_id();
+	tiny::utime_t base = tiny::utime_t::now();
+	char buf[512];
+	char check[512];
+	size_t sink = 0;
+
+	// one entry every 3us, so a cached second is reused for ~330k entries
+	auto stamp_of = [&base](size_t i) { return base + (double)(i * 3) / 1000000.0; };
+
+	double before = entries_per_sec([&](size_t i) {
+		tiny::utime_t stamp = stamp_of(i);
+		size_t used = (size_t)stamp.snprintf_t(buf, sizeof(buf));
+		used += (size_t)snprintf(buf + used, sizeof(buf) - used, " <%s> thread id(0x%lx), log level(%2d) ", name.c_str(), thread, (int)(i % 30) - 1);
+		sink += used;
+	});
+
+	tiny::LogHeaderFormatter header;
+	double after = entries_per_sec([&](size_t i) {
+		sink += header.format(buf, sizeof(buf), stamp_of(i), name, thread, (int)(i % 30) - 1);
+	});
+
+	for (size_t i = 0; i < ENTRIES; i += 9973)
+	{
+		tiny::utime_t stamp = stamp_of(i);
+		size_t used = header.format(buf, sizeof(buf), stamp, name, thread, (int)(i % 30) - 1);
+		size_t expect = (size_t)stamp.snprintf_t(check, sizeof(check));
+		expect += (size_t)snprintf(check + expect, sizeof(check) - expect, " <%s> thread id(0x%lx), log level(%2d) ", name.c_str(), thread, (int)(i % 30) - 1);
+		if (used != expect || memcmp(buf, check, used) != 0)
+		{
+			printf("mismatch at %zu:\n  %.*s\n  %.*s\n", i, (int)expect, check, (int)used, buf);
+			return 1;
+		}
+	}
+
+	printf("log header formatting, %zu entries\n", ENTRIES);
+	printf("  snprintf_t + snprintf : %12.0f entries/sec\n", before);
+	printf("  LogHeaderFormatter    : %12.0f entries/sec (x%.2f)\n", after, after / before);
+	return (sink == 0);
+}
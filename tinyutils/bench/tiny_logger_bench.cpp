@@ -0,0 +1,222 @@
+// tiny_logger_bench.cpp : tiny::Logger hot path, 1..N producer threads against a null
+// writer and a file writer: dout cost when enabled and disabled, submit latency
+// percentiles and the sustained rate the logger thread writes out.
+//
+// usage: tiny_logger_bench [max_threads] [entries_per_thread] [file]
+//
+
+#include "tiny_logger.h"
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+
+using bench_clock = std::chrono::steady_clock;
+
+/*
+*	class BenchWriter
+*
+*	Counts the lines written out; discards them or appends them to a file.
+*/
+class BenchWriter : public tiny::Logger::WriterImpl
+{
+public:
+	BenchWriter()
+		: fd_(-1)
+		, lines_(0)
+	{
+	}
+	~BenchWriter() override
+	{
+		set_file(std::string());
+	}
+public:
+	void Write(const char* data, size_t len) override
+	{
+		lines_.fetch_add(std::count(data, data + len, '\n'), std::memory_order_relaxed);
+		int fd = fd_.load(std::memory_order_relaxed);
+		if (fd >= 0)
+		{
+			while (len > 0)
+			{
+				ssize_t ret = ::write(fd, data, len);
+				if (ret <= 0)
+				{
+					break;
+				}
+				data += ret;
+				len -= (size_t)ret;
+			}
+		}
+	}
+	void WriteV(const tiny::stringview* bufs, size_t count) override
+	{
+		int fd = fd_.load(std::memory_order_relaxed);
+		size_t lines = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			lines += std::count(bufs[i].begin(), bufs[i].end(), '\n');
+			if (fd >= 0)
+			{
+				const char* data = bufs[i].data();
+				size_t len = bufs[i].size();
+				while (len > 0)
+				{
+					ssize_t ret = ::write(fd, data, len);
+					if (ret <= 0)
+					{
+						break;
+					}
+					data += ret;
+					len -= (size_t)ret;
+				}
+			}
+		}
+		lines_.fetch_add(lines, std::memory_order_relaxed);
+	}
+	void Print(const char* data, size_t len) override
+	{
+	}
+	void set_file(const std::string& path)
+	{
+		int old = fd_.exchange(path.empty() ? -1 : ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+		if (old >= 0)
+		{
+			::close(old);
+		}
+	}
+	uint64_t lines() const { return lines_.load(std::memory_order_relaxed); }
+private:
+	std::atomic_int fd_;
+	std::atomic<uint64_t> lines_;
+};
+
+struct RunResult
+{
+	double enabled_ns;
+	double disabled_ns;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+	double entries_per_sec;
+};
+
+template<typename F>
+static void run_threads(size_t threads, F&& f)
+{
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; ++t)
+	{
+		workers.emplace_back([&f, t] { f(t); });
+	}
+	for (std::thread& w : workers)
+	{
+		w.join();
+	}
+}
+
+static RunResult run(BenchWriter& writer, size_t threads, size_t entries)
+{
+	RunResult r;
+	std::vector<std::vector<uint32_t>> latency(threads);
+	std::vector<double> disabled(threads);
+
+	// disabled: priority 30 is above every threshold, only the check is paid for
+	run_threads(threads, [&](size_t t) {
+		auto begin = bench_clock::now();
+		for (size_t i = 0; i < entries; ++i)
+		{
+			dout_impl(30, bench) << "never formatted " << i << dendl;
+		}
+		disabled[t] = std::chrono::duration<double, std::nano>(bench_clock::now() - begin).count() / entries;
+	});
+	r.disabled_ns = 0;
+	for (double d : disabled)
+	{
+		r.disabled_ns += d / threads;
+	}
+
+	uint64_t lines = writer.lines();
+	auto begin = bench_clock::now();
+	run_threads(threads, [&](size_t t) {
+		std::vector<uint32_t>& lat = latency[t];
+		lat.reserve(entries);
+		for (size_t i = 0; i < entries; ++i)
+		{
+			auto s = bench_clock::now();
+			dout_impl(1, bench) << "request " << i << " from thread " << t << " took " << 1.5 * i << " us" << dendl;
+			lat.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - s).count());
+		}
+	});
+	double submit_secs = std::chrono::duration<double>(bench_clock::now() - begin).count();
+	const uint64_t expect = lines + threads * entries;
+	while (writer.lines() < expect)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+	double secs = std::chrono::duration<double>(bench_clock::now() - begin).count();
+
+	std::vector<uint32_t> all;
+	for (std::vector<uint32_t>& lat : latency)
+	{
+		all.insert(all.end(), lat.begin(), lat.end());
+	}
+	std::sort(all.begin(), all.end());
+	r.p50 = all[all.size() / 2];
+	r.p99 = all[all.size() * 99 / 100];
+	r.p999 = all[all.size() * 999 / 1000];
+	r.enabled_ns = submit_secs * 1e9 * threads / all.size();
+	r.entries_per_sec = all.size() / secs;
+	return r;
+}
+
+int main(int argc, char** argv)
+{
+	size_t max_threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), 8);
+	size_t entries = 200000;
+	std::string file = "tiny_logger_bench.log";
+	if (argc > 1)
+	{
+		max_threads = std::max(1, atoi(argv[1]));
+	}
+	if (argc > 2)
+	{
+		entries = std::max(1, atoi(argv[2]));
+	}
+	if (argc > 3)
+	{
+		file = argv[3];
+	}
+
+	BenchWriter* writer = new BenchWriter;
+	tiny::Logger* logger = tiny::Logger::Instance();
+	if (logger->initialize(1, std::string(), std::unique_ptr<tiny::Logger::WriterImpl>(writer)) != 0)
+	{
+		printf("logger initialize failed\n");
+		return 1;
+	}
+	logger->set_log_subsys("bench", -1, 5);
+
+	printf("tiny::Logger, %zu entries per thread; latency is the whole dout ... dendl\n", entries);
+	printf("%-6s %7s %12s %12s %8s %8s %8s %14s\n", "writer", "threads", "enabled ns", "disabled ns", "p50", "p99", "p999", "entries/sec");
+	const char* names[] = { "null", "file" };
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		writer->set_file(mode == 0 ? std::string() : file);
+		for (size_t threads = 1; threads <= max_threads; threads *= 2)
+		{
+			RunResult r = run(*writer, threads, entries);
+			printf("%-6s %7zu %12.1f %12.2f %8llu %8llu %8llu %14.0f\n", names[mode], threads,
+				r.enabled_ns, r.disabled_ns,
+				(unsigned long long)r.p50, (unsigned long long)r.p99, (unsigned long long)r.p999,
+				r.entries_per_sec);
+			if (threads < max_threads && threads * 2 > max_threads)
+			{
+				threads = max_threads / 2;
+			}
+		}
+	}
+	writer->set_file(std::string());
+	::unlink(file.c_str());
+	return 0;
+}
@@ -52,6 +52,10 @@ namespace tiny
 		__attribute__((__noreturn__));
 	extern void __tiny_assert_warn(const char* assertion, const char* file, int line, const char* function);
 
+	/* Called by a failed assert or tiny_abort right before the process aborts. */
+	typedef void (*tiny_abort_hook_t)();
+	void set_tiny_abort_hook(tiny_abort_hook_t hook);
+
 	[[noreturn]] void __tiny_abort(const char* file, int line, const char* func,
 		const std::string& msg);
 
@@ -4,16 +4,24 @@
 #include "tiny_assert.h"
 #include "tiny_time.h"
 #include "tiny_locker.h"
+#include "tiny_location.h"
 #include <condition_variable>
 #include <deque>
 #include <thread>
 #include <map>
+#include <vector>
+#include <memory>
 #include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
 namespace tiny
 {
 #define EVENT_NONE 0
 #define EVENT_READABLE 1
 #define EVENT_WRITABLE 2
+#define EVENT_EDGE 4				// edge triggered, the callback has to drain the fd
+#define EVENT_DROPPED 8				// fired only: the driver stopped polling the fd, it has to be registered again
 
 	class EventCenter;
 	/*
@@ -22,13 +30,25 @@ namespace tiny
 	class EventCallback {
 
 	public:
-		EventCallback(bool delete_need = false):need_delete(delete_need){}
+		EventCallback(bool delete_need = false)
+			: need_delete(delete_need)
+			, external_next(nullptr)
+			, external_queued(false)
+		{}
 		virtual ~EventCallback() {}       // we want a virtual destructor!!!
 	public:
 		virtual void do_request(uint64_t id) = 0;
 		bool delete_after() const { return need_delete; }
+		/* Where the callback came from, reported as the slowest callback by EventCenterStats. */
+		const Location& location() const { return location_; }
+		void set_location(const Location& from) { location_ = from; }
 	private:
 		bool need_delete;
+		Location location_;
+		// link of EventCenter's external queue, a callback is queued at most once
+		std::atomic<EventCallback*> external_next;
+		std::atomic_bool external_queued;
+		friend class EventCenter;
 	};
 
 	using EventCallbackRef = EventCallback*;
@@ -89,6 +109,61 @@ namespace tiny
 		bool delete_after_;
 	};
 
+	/*
+	*	class SubmitNode
+	*
+	*	A closure on its way to EventCenter::submit_to's loop. Nodes are taken from a
+	*	pool of the submitting thread and go back to it once run; closures up to
+	*	INLINE_SIZE bytes live inside the node, so steady state submitting doesn't
+	*	allocate. A synchronous submitter waits on done_ with a futex.
+	*/
+	class SubmitNode : public EventCallback
+	{
+	public:
+		static const size_t INLINE_SIZE = 64;
+	public:
+		template <typename func>
+		static SubmitNode* make(func&& f, bool sync)
+		{
+			using F = typename std::decay<func>::type;
+			SubmitNode* n = acquire();
+			n->sync_ = sync;
+			n->done_.store(0, std::memory_order_relaxed);
+			if (sizeof(F) <= INLINE_SIZE && alignof(F) <= alignof(std::max_align_t))
+			{
+				n->target_ = new (n->storage_) F(std::forward<func>(f));
+				n->destroy_ = &destroy_inline<F>;
+			}
+			else
+			{
+				n->target_ = new F(std::forward<func>(f));
+				n->destroy_ = &destroy_heap<F>;
+			}
+			n->invoke_ = &invoke<F>;
+			return n;
+		}
+	public:
+		void do_request(uint64_t id) override;
+		/* Synchronous submitter: wait until the loop ran it, then hand the node back. */
+		void wait_and_release();
+	private:
+		SubmitNode();
+		static SubmitNode* acquire();
+		template <typename F> static void invoke(void* p) { (*static_cast<F*>(p))(); }
+		template <typename F> static void destroy_inline(void* p) { static_cast<F*>(p)->~F(); }
+		template <typename F> static void destroy_heap(void* p) { delete static_cast<F*>(p); }
+	private:
+		alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+		void* target_;
+		void (*invoke_)(void*);
+		void (*destroy_)(void*);
+		bool sync_;
+		std::atomic<uint32_t> done_;
+		class Pool;
+		Pool* pool_;
+		SubmitNode* pool_next_;
+	};
+
 	struct FiredFileEvent {
 		int fd;
 		int mask;
@@ -110,6 +185,143 @@ namespace tiny
 		virtual bool need_wakeup() { return true; }
 	};
 
+	/*
+	*	class EventCenterStats
+	*
+	*	Health of one EventCenter. The loop writes with relaxed stores, any thread may
+	*	read without a lock; times are in nanoseconds. A loop is stuck when
+	*	running_for_ns() keeps growing.
+	*/
+	class EventCenterStats
+	{
+	public:
+		static const int HISTOGRAM_BUCKETS = 24;			// bucket i: iterations under 2^i microseconds, the last takes the rest
+	public:
+		EventCenterStats();
+	public:
+		uint64_t iterations() const { return iterations_.load(std::memory_order_relaxed); }
+		uint64_t wait_ns() const { return wait_ns_.load(std::memory_order_relaxed); }
+		uint64_t callback_ns() const { return callback_ns_.load(std::memory_order_relaxed); }
+		uint64_t callbacks() const { return callbacks_.load(std::memory_order_relaxed); }
+		uint64_t time_events_fired() const { return time_events_fired_.load(std::memory_order_relaxed); }
+		uint64_t external_processed() const { return external_processed_.load(std::memory_order_relaxed); }
+		uint64_t external_depth() const;
+		uint64_t iteration_histogram(int bucket) const { return histogram_[bucket].load(std::memory_order_relaxed); }
+		/* How long the callback running now has been running, 0 when none is. */
+		uint64_t running_for_ns() const;
+		uint64_t slowest_callback(Location* where) const;
+	private:
+		static void add(std::atomic<uint64_t>& counter, uint64_t value)
+		{
+			// single writer, no need for a locked add
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+		void add_iteration(uint64_t ns);
+		void add_callback(const Location& where, uint64_t ns);
+	private:
+		std::atomic<uint64_t> iterations_;
+		std::atomic<uint64_t> wait_ns_;
+		std::atomic<uint64_t> callback_ns_;
+		std::atomic<uint64_t> callbacks_;
+		std::atomic<uint64_t> time_events_fired_;
+		std::atomic<uint64_t> external_processed_;
+		std::atomic<uint64_t> external_pushed_;			// the only counter producers write
+		std::atomic<uint64_t> running_since_;
+		std::atomic<uint64_t> histogram_[HISTOGRAM_BUCKETS];
+		// seqlock, odd while the loop writes
+		std::atomic<uint32_t> slowest_seq_;
+		std::atomic<uint64_t> slowest_ns_;
+		std::atomic<const char*> slowest_function_;
+		std::atomic<const char*> slowest_file_line_;
+		friend class EventCenter;
+	};
+
+	/*
+	*	class TimerWheel
+	*
+	*	Hierarchical timing wheel, LEVELS wheels of SLOTS slots with one tick per
+	*	millisecond. Timers live in a pool of nodes linked into their slot by index, so
+	*	arming and cancelling are O(1) and allocate nothing once the pool has grown.
+	*	An id carries the node's generation; a stale id cancels nothing.
+	*/
+	class TimerWheel
+	{
+		static const int LEVELS = 4;
+		static const int SLOT_BITS = 8;
+		static const uint32_t SLOTS = 1u << SLOT_BITS;
+		static const uint32_t NIL = 0xffffffffu;
+		struct Node {
+			uint64_t expire;
+			EventCallbackRef cb;
+			uint32_t gen;
+			uint32_t prev;
+			uint32_t next;
+			uint32_t slot;			// level * SLOTS + index, NIL when free
+		};
+	public:
+		TimerWheel();
+	public:
+		uint64_t now() const { return now_; }
+		size_t size() const { return count_; }
+		/* An empty wheel first moves to tick now, so time spent idle is not walked later. */
+		uint64_t add(uint64_t now, uint64_t expire, EventCallbackRef cb);
+		bool cancel(uint64_t id);
+		/* Tick of the next expiry, or of the next cascade a pending timer is waiting for; UINT64_MAX when empty. */
+		uint64_t next_expiry() const;
+		/* Moves to tick to, calls f(id, cb) for every timer that expires up to it. */
+		template <typename F>
+		int advance(uint64_t to, F&& f)
+		{
+			int fired = 0;
+			while (now_ < to)
+			{
+				if (count_ == 0)
+				{
+					now_ = to;
+					break;
+				}
+				// jump to the next occupied level 0 slot or to the next cascade, whichever comes first
+				uint32_t idx = (uint32_t)(now_ & (SLOTS - 1));
+				uint32_t n = next_set(0, idx + 1);
+				uint64_t target = (n < SLOTS && n > idx) ? (now_ - idx + n) : ((now_ | (SLOTS - 1)) + 1);
+				if (target > to)
+				{
+					now_ = to;
+					break;
+				}
+				now_ = target;
+				cascade();
+				uint32_t slot = (uint32_t)(now_ & (SLOTS - 1));
+				while (heads_[slot] != NIL)
+				{
+					uint32_t i = heads_[slot];
+					EventCallbackRef cb = nodes_[i].cb;
+					uint64_t id = make_id(i);
+					unlink(i);
+					release(i);
+					++fired;
+					f(id, cb);
+				}
+			}
+			return fired;
+		}
+		void clear();
+	private:
+		uint64_t make_id(uint32_t i) const { return ((uint64_t)nodes_[i].gen << 32) | (i + 1); }
+		void link(uint32_t i);
+		void unlink(uint32_t i);
+		void release(uint32_t i);
+		void cascade();
+		uint32_t next_set(int level, uint32_t from) const;
+	private:
+		uint64_t now_;
+		size_t count_;
+		uint32_t free_;
+		std::vector<Node> nodes_;
+		uint32_t heads_[LEVELS * SLOTS];
+		uint64_t occupied_[LEVELS][SLOTS / 64];
+	};
+
 	/*
 	*	class EventCenter
 	*/
@@ -118,13 +330,6 @@ namespace tiny
 	{
 	public:
 		using clock_type = time_detail::mono_clock;
-	private:
-		struct TimeEvent {
-			uint64_t id;
-			EventCallbackRef time_cb;
-
-			TimeEvent() : id(0), time_cb(NULL) {}
-		};
 	public:
 		EventCenter();
 		virtual ~EventCenter();
@@ -134,53 +339,53 @@ namespace tiny
 		const std::thread::id& get_owner() const { return owner; }
 		bool in_thread() const;
 		void notify();
+		/* Fires after at least microseconds, on a 1ms tick. */
 		uint64_t create_time_event(uint64_t microseconds, EventCallbackRef ctxt);
 		void delete_time_event(uint64_t id);
 		int process_events(unsigned timeout_microseconds);
 		void dispatch_event_external(EventCallbackRef e);
+		/*
+		 * Latency mode: before parking, process_events polls the external queue and the
+		 * fds with a zero timeout for up to budget_microseconds, so producers need no
+		 * wakeup. Adaptive halves the budget after a spin that found nothing and doubles
+		 * it back after one that did. 0 turns it off; owner thread only.
+		 */
+		void set_busy_poll(unsigned budget_microseconds, bool adaptive = true);
+		/* Starts counting into stats(); off by default, the counters cost a clock read per callback. */
+		void enable_stats();
+		const EventCenterStats* stats() const { return stats_.load(std::memory_order_acquire); }
 	protected:
 		virtual int initialize() { return 0; }
 		virtual void uninitialize() {}
 		virtual void wakeup() = 0;
 		virtual int event_wait(struct timeval* tv) = 0;
-	private:
-		int process_time_events();
-	private:
-		template <typename func>
-		class C_submit_event : public EventCallback {
-			std::mutex lock;
-			std::condition_variable cond;
-			bool done = false;
-			func f;
-			bool nonwait;
-		public:
-			C_submit_event(func&& _f, bool nowait)
-				: f(std::move(_f)), nonwait(nowait) {}
-			void do_request(uint64_t id) override {
-				f();
-
-				lock_guard l(lock);
-				cond.notify_all();
-				done = true;
-			}
-			bool delete_after() const
+		void run_callback(EventCallbackRef cb, uint64_t id)
+		{
+			EventCenterStats* stats = stats_.load(std::memory_order_relaxed);
+			if (stats)
 			{
-				return nonwait;
+				run_timed(stats, cb, id);
 			}
-			void wait() {
-				tiny_assert(!delete_after());
-				unique_lock l(lock);
-				while (!done)
-					cond.wait(l);
+			else
+			{
+				cb->do_request(id);
 			}
-		};
-
+		}
+	private:
+		void run_timed(EventCenterStats* stats, EventCallbackRef cb, uint64_t id);
+		int process_time_events();
+		int process_external_events();
+		bool busy_poll(clock_type::time_point deadline, int& numevents);
+		uint64_t to_tick(clock_type::time_point t) const;
+		EventCallbackRef pop_external();
+		void push_external(EventCallbackRef e);
 	public:
 		template <typename func>
-		void submit_to(func&& f, bool always_async = false) {
+		void submit_to(func&& f, bool always_async = false, const Location& from = Location()) {
 			EventCenter* c = this;
 			if (always_async) {
-				C_submit_event<func>* event = new C_submit_event<func>(std::move(f), true);
+				SubmitNode* event = SubmitNode::make(std::forward<func>(f), false);
+				event->set_location(from);
 				c->dispatch_event_external(event);
 			}
 			else if (c->in_thread()) {
@@ -188,19 +393,73 @@ namespace tiny
 				return;
 			}
 			else {
-				C_submit_event<func> event(std::move(f), false);
-				c->dispatch_event_external(&event);
-				event.wait();
+				// the caller's f outlives the call, only a reference travels
+				SubmitNode* event = SubmitNode::make([&f] { f(); }, true);
+				event->set_location(from);
+				c->dispatch_event_external(event);
+				event->wait_and_release();
 			}
 		};
 	private:
-		uint64_t time_event_next_id;
+		class C_stub : public EventCallback {
+		public:
+			void do_request(uint64_t id) override {}
+		};
+		// per external batch, the rest waits for the next loop so timers and fds aren't starved
+		static const int MAX_EXTERNAL_BATCH = 1024;
+		clock_type::time_point time_base;
 		std::thread::id owner;
-		std::mutex external_lock;
-		std::atomic_ulong external_num_events;
-		std::deque<EventCallbackRef> external_events;
-		std::multimap<clock_type::time_point, TimeEvent> time_events;
-		std::map<uint64_t, std::multimap<clock_type::time_point, TimeEvent>::iterator> event_map;
+		unsigned busy_poll_max;
+		unsigned busy_poll_budget;
+		bool busy_poll_adaptive;
+		// intrusive MPSC queue (Vyukov): producers exchange external_head, the owner pops at external_tail
+		alignas(64) std::atomic<EventCallbackRef> external_head;
+		alignas(64) EventCallbackRef external_tail;
+		std::atomic_bool external_parked;		// the owner is about to wait or waiting in event_wait
+		C_stub external_stub;
+		TimerWheel time_events;
+		std::atomic<EventCenterStats*> stats_;
+		uint64_t callback_ns_local;			// callback time so far, to take it out of event_wait's
+	};
+
+#ifndef UNI_WIN
+	/*
+	*	class FileEventCenter
+	*
+	*	EventCenter with per fd read/write callbacks on an EventDriver (epoll, or
+	*	io_uring if asked for and the kernel has it), woken up through an eventfd.
+	*	The callbacks stay owned by the caller; do_request gets the fd. File events are only touched from the owner thread.
+	*/
+	class FileEventCenter : public EventCenter
+	{
+		struct FileEvent {
+			int mask;
+			EventCallbackRef read_cb;
+			EventCallbackRef write_cb;
+
+			FileEvent() : mask(0), read_cb(NULL), write_cb(NULL) {}
+		};
+	public:
+		explicit FileEventCenter(int nevent = 5000, bool use_uring = false);
+		~FileEventCenter() override;
+	public:
+		int create_file_event(int fd, int mask, EventCallbackRef ctxt);
+		void delete_file_event(int fd, int mask);
+	protected:
+		int initialize() override;
+		void uninitialize() override;
+		void wakeup() override;
+		int event_wait(struct timeval* tv) override;
+	private:
+		class C_drain_notify;
+		int nevent_;
+		bool use_uring_;
+		std::unique_ptr<EventDriver> driver_;
+		std::vector<FileEvent> file_events_;
+		std::vector<FiredFileEvent> fired_events_;
+		std::atomic_int notify_fd_;
+		std::unique_ptr<EventCallback> notify_cb_;
 	};
+#endif // !UNI_WIN
 }
 #endif // !TINY_EVENT_CENTER_H
@@ -0,0 +1,168 @@
+#ifndef TINY_EVENT_CORO_H
+#define	TINY_EVENT_CORO_H
+
+#include "tiny_event_center.h"
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#endif
+#endif
+
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+#include <exception>
+namespace tiny
+{
+namespace coro
+{
+	/*
+	*	struct task
+	*
+	*	Detached coroutine: starts running at the call, frees its frame when it returns.
+	*	Its frame is the only allocation, the awaitables below live in it.
+	*/
+	struct task
+	{
+		struct promise_type
+		{
+			task get_return_object() noexcept { return task(); }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+
+	/*
+	*	class resume_callback
+	*
+	*	EventCallback that resumes the awaiting coroutine.
+	*/
+	class resume_callback : public EventCallback
+	{
+	public:
+		void do_request(uint64_t id) override
+		{
+			// the last touch, the coroutine may free this as it runs
+			handle_.resume();
+		}
+	protected:
+		std::coroutine_handle<> handle_;
+	};
+
+#ifndef UNI_WIN
+	/*
+	*	class fd_awaiter
+	*
+	*	Suspends until fd is readable or writable, on the owner thread of center. The
+	*	event is one shot; co_await gives 0 or the error create_file_event failed with.
+	*/
+	class fd_awaiter : public resume_callback
+	{
+	public:
+		fd_awaiter(FileEventCenter& center, int fd, int mask)
+			: center_(center), fd_(fd), mask_(mask), armed_(false), result_(0) {}
+		fd_awaiter(const fd_awaiter&) = delete;
+		~fd_awaiter()
+		{
+			// the coroutine was destroyed while waiting
+			if (armed_)
+			{
+				center_.delete_file_event(fd_, mask_);
+			}
+		}
+	public:
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend(std::coroutine_handle<> h)
+		{
+			handle_ = h;
+			result_ = center_.create_file_event(fd_, mask_, this);
+			armed_ = (result_ == 0);
+			return armed_;
+		}
+		int await_resume() const noexcept { return result_; }
+		void do_request(uint64_t id) override
+		{
+			armed_ = false;
+			center_.delete_file_event(fd_, mask_);
+			resume_callback::do_request(id);
+		}
+	private:
+		FileEventCenter& center_;
+		int fd_;
+		int mask_;
+		bool armed_;
+		int result_;
+	};
+
+	inline fd_awaiter readable(FileEventCenter& center, int fd) { return fd_awaiter(center, fd, EVENT_READABLE); }
+	inline fd_awaiter writable(FileEventCenter& center, int fd) { return fd_awaiter(center, fd, EVENT_WRITABLE); }
+#endif // !UNI_WIN
+
+	/*
+	*	class sleep_awaiter
+	*
+	*	Suspends for at least microseconds on a time event of center, owner thread only.
+	*/
+	class sleep_awaiter : public resume_callback
+	{
+	public:
+		sleep_awaiter(EventCenter& center, uint64_t microseconds)
+			: center_(center), microseconds_(microseconds), id_(0) {}
+		sleep_awaiter(const sleep_awaiter&) = delete;
+		~sleep_awaiter()
+		{
+			if (id_)
+			{
+				center_.delete_time_event(id_);
+			}
+		}
+	public:
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			handle_ = h;
+			id_ = center_.create_time_event(microseconds_, this);
+		}
+		void await_resume() const noexcept {}
+		void do_request(uint64_t id) override
+		{
+			id_ = 0;
+			resume_callback::do_request(id);
+		}
+	private:
+		EventCenter& center_;
+		uint64_t microseconds_;
+		uint64_t id_;
+	};
+
+	inline sleep_awaiter sleep_for(EventCenter& center, uint64_t microseconds) { return sleep_awaiter(center, microseconds); }
+
+	/*
+	*	class submit_awaiter
+	*
+	*	Moves the coroutine to the loop of center: it goes on as an external event
+	*	there. From any thread; from center's own thread it goes on without suspending.
+	*/
+	class submit_awaiter : public resume_callback
+	{
+	public:
+		explicit submit_awaiter(EventCenter& center) : center_(center) {}
+		submit_awaiter(const submit_awaiter&) = delete;
+	public:
+		bool await_ready() const noexcept { return center_.in_thread(); }
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			handle_ = h;
+			center_.dispatch_event_external(this);
+		}
+		void await_resume() const noexcept {}
+	private:
+		EventCenter& center_;
+	};
+
+	inline submit_awaiter submit_to(EventCenter& center) { return submit_awaiter(center); }
+}
+}
+#endif // __cpp_impl_coroutine && __cpp_lib_coroutine
+#endif // !TINY_EVENT_CORO_H
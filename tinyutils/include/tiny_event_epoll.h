@@ -0,0 +1,35 @@
+#ifndef TINY_EVENT_EPOLL_H
+#define	TINY_EVENT_EPOLL_H
+
+#include "tiny_event_center.h"
+
+#ifndef UNI_WIN
+#include <sys/epoll.h>
+namespace tiny
+{
+	/*
+	*	class EpollDriver
+	*
+	*	EventDriver on epoll(7), level triggered unless EVENT_EDGE is in the mask.
+	*/
+	class EpollDriver : public EventDriver
+	{
+	public:
+		EpollDriver();
+		~EpollDriver() override;
+	public:
+		int init(EventCenter* center, int nevent) override;
+		int add_event(int fd, int cur_mask, int add_mask) override;
+		int del_event(int fd, int cur_mask, int del_mask) override;
+		int event_wait(std::vector<FiredFileEvent>& fired_events, struct timeval* tp) override;
+		int resize_events(int newsize) override;
+	private:
+		static uint32_t to_epoll(int mask);
+	private:
+		int epfd_;
+		int size_;
+		struct epoll_event* events_;
+	};
+}
+#endif // !UNI_WIN
+#endif // !TINY_EVENT_EPOLL_H
@@ -0,0 +1,89 @@
+#ifndef TINY_EVENT_POOL_H
+#define	TINY_EVENT_POOL_H
+
+#include "tiny_event_center.h"
+#include "tiny_thread.h"
+
+#ifndef UNI_WIN
+namespace tiny
+{
+	/*
+	*	class EventCenterPool
+	*
+	*	N FileEventCenters, each looping on a ThreadStack thread of its own, optionally
+	*	pinned one per CPU of the process affinity mask unless set_placement gave cpus.
+	*	Connections are spread over the loops round-robin or by a hash of a key, after
+	*	that a connection only lives on its loop.
+	*/
+	class EventCenterPool : public ThreadStack
+	{
+		struct Loop : public ThreadStack::Worker {
+			FileEventCenter center;
+
+			explicit Loop(bool use_uring) : center(5000, use_uring) {}
+
+			// EventCenter is cache line aligned, plain new does not honour that before C++17
+			static void* operator new(size_t size)
+			{
+				void* p = nullptr;
+				if (posix_memalign(&p, 64, size) != 0)
+				{
+					throw std::bad_alloc();
+				}
+				return p;
+			}
+			static void operator delete(void* p) { free(p); }
+		};
+	public:
+		enum class Balance
+		{
+			round_robin,
+			hash,				// by the key, e.g. fd or peer address, so it sticks to a loop
+		};
+	public:
+		/* loops == 0 starts one per hardware thread. */
+		explicit EventCenterPool(size_t loops = 0, bool pin_cpu = true, unsigned timeout_microseconds = 30000000, bool use_uring = false);
+		~EventCenterPool() override;
+	public:
+		int start() { return Create(); }
+		void stop() { Destroy(); }
+		size_t size() const { return loops_.size(); }
+		FileEventCenter* get(size_t loop_index) { return &loops_[loop_index]->center; }
+		size_t next_loop() { return (next_.fetch_add(1, std::memory_order_relaxed) % loops_.size()); }
+		size_t loop_for(uint64_t key) const;
+		template <typename func>
+		void submit_to(size_t loop_index, func&& f, bool always_async = false, const Location& from = Location())
+		{
+			get(loop_index)->submit_to(std::forward<func>(f), always_async, from);
+		}
+		/*
+		 * Hands an accepted fd to a loop: on_loop(FileEventCenter*, fd) runs there to
+		 * register its file events. Returns the loop index.
+		 */
+		template <typename func>
+		size_t assign_fd(int fd, func&& on_loop, Balance balance = Balance::round_robin)
+		{
+			size_t index = (balance == Balance::hash) ? loop_for((uint64_t)fd) : next_loop();
+			FileEventCenter* center = get(index);
+			typename std::decay<func>::type f(std::forward<func>(on_loop));
+			center->submit_to([center, fd, f]() mutable { f(center, fd); }, true);
+			return index;
+		}
+	protected:
+		int OnCreate(size_t& thread_nums) override;
+		ThreadPlacement thread_placement() const override;
+		void OnDestroyed() override;
+		std::function<void()> add_thread(unsigned int thread_index) override;
+		void remove_thread(unsigned int index) override;
+		void wait_started(unsigned int index) override;
+	private:
+		size_t nloops_;
+		bool pin_cpu_;
+		bool use_uring_;
+		unsigned timeout_;
+		std::atomic<size_t> next_;
+		std::vector<std::unique_ptr<Loop>> loops_;
+	};
+}
+#endif // !UNI_WIN
+#endif // !TINY_EVENT_POOL_H
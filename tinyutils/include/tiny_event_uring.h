@@ -0,0 +1,62 @@
+#ifndef TINY_EVENT_URING_H
+#define	TINY_EVENT_URING_H
+
+#include "tiny_event_center.h"
+
+#ifndef UNI_WIN
+struct io_uring_sqe;
+struct io_uring_cqe;
+namespace tiny
+{
+	/*
+	*	class UringDriver
+	*
+	*	EventDriver on io_uring(7) poll requests, driven by raw syscalls. Poll adds and
+	*	removes are only queued on the submission ring and go to the kernel with the next
+	*	event_wait, in the same io_uring_enter that waits for completions. A poll is one
+	*	shot and re-armed when it completes, which is level triggered; EVENT_EDGE is
+	*	served the same way. init fails with -ENOSYS where the kernel (< 5.11) or the
+	*	build lacks what is needed, the caller is expected to fall back to epoll.
+	*/
+	class UringDriver : public EventDriver
+	{
+	public:
+		UringDriver();
+		~UringDriver() override;
+	public:
+		int init(EventCenter* center, int nevent) override;
+		int add_event(int fd, int cur_mask, int add_mask) override;
+		int del_event(int fd, int cur_mask, int del_mask) override;
+		int event_wait(std::vector<FiredFileEvent>& fired_events, struct timeval* tp) override;
+		int resize_events(int newsize) override;
+	private:
+		unsigned sq_space();
+		struct io_uring_sqe* get_sqe();
+		int enter(unsigned wait_nr, struct timeval* tvp);
+		int poll_add(int fd);
+		int poll_remove(int fd);
+		int rearm(int fd, int mask);
+	private:
+		int ring_fd_;
+		int size_;
+		unsigned pending_;					// queued on the ring, not entered yet
+		void* sq_ptr_;
+		size_t sq_len_;
+		unsigned* sq_head_;
+		unsigned* sq_tail_;
+		unsigned sq_mask_;
+		unsigned sq_entries_;
+		struct io_uring_sqe* sqes_;
+		size_t sqes_len_;
+		void* cq_ptr_;
+		size_t cq_len_;
+		unsigned* cq_head_;
+		unsigned* cq_tail_;
+		unsigned cq_mask_;
+		struct io_uring_cqe* cqes_;
+		std::vector<int> masks_;			// armed mask of each fd
+		std::vector<uint32_t> gens_;		// bumped when an fd's poll is replaced, stale completions are dropped
+	};
+}
+#endif // !UNI_WIN
+#endif // !TINY_EVENT_URING_H
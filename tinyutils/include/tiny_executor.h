@@ -0,0 +1,225 @@
+#ifndef TINY_EXECUTOR_H
+#define	TINY_EXECUTOR_H
+
+#include "tiny_thread.h"
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace tiny
+{
+	/*
+	*	class WorkDeque
+	*
+	*	Chase-Lev work stealing deque (Le et al., "Correct and Efficient Work-Stealing for
+	*	Weak Memory Models"). The owner pushes and pops at the bottom, any thread steals
+	*	from the top. The array doubles when full; old arrays are kept until destruction
+	*	since a thief may still read them.
+	*/
+	template <typename T>
+	class WorkDeque
+	{
+		struct Array
+		{
+			explicit Array(int64_t n) : size(n), slots(new std::atomic<T*>[n]) {}
+			T* get(int64_t i) const { return slots[i & (size - 1)].load(std::memory_order_relaxed); }
+			void put(int64_t i, T* x) { slots[i & (size - 1)].store(x, std::memory_order_relaxed); }
+			int64_t size;
+			std::unique_ptr<std::atomic<T*>[]> slots;
+		};
+	public:
+		explicit WorkDeque(int64_t capacity = 256)
+			: top_(0)
+			, bottom_(0)
+			, array_(new Array(capacity))
+		{
+			arrays_.push_back(std::unique_ptr<Array>(array_.load()));
+		}
+		WorkDeque(const WorkDeque&) = delete;
+		WorkDeque& operator = (const WorkDeque&) = delete;
+	public:
+		void push(T* x)
+		{
+			int64_t b = bottom_.load(std::memory_order_relaxed);
+			int64_t t = top_.load(std::memory_order_acquire);
+			Array* a = array_.load(std::memory_order_relaxed);
+			if (b - t > a->size - 1)
+			{
+				a = grow(a, t, b);
+			}
+			a->put(b, x);
+			bottom_.store(b + 1, std::memory_order_release);
+		}
+		T* pop()
+		{
+			int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+			Array* a = array_.load(std::memory_order_relaxed);
+			bottom_.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = top_.load(std::memory_order_relaxed);
+			if (t > b)
+			{
+				bottom_.store(b + 1, std::memory_order_relaxed);
+				return nullptr;
+			}
+			T* x = a->get(b);
+			if (t == b)
+			{
+				// the last one, race the thieves for it
+				if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				{
+					x = nullptr;
+				}
+				bottom_.store(b + 1, std::memory_order_relaxed);
+			}
+			return x;
+		}
+		T* steal()
+		{
+			int64_t t = top_.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = bottom_.load(std::memory_order_acquire);
+			if (t >= b)
+			{
+				return nullptr;
+			}
+			T* x = array_.load(std::memory_order_acquire)->get(t);
+			if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			{
+				return nullptr;
+			}
+			return x;
+		}
+		bool empty() const
+		{
+			return (bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed));
+		}
+	private:
+		Array* grow(Array* a, int64_t t, int64_t b)
+		{
+			Array* bigger = new Array(a->size * 2);
+			for (int64_t i = t; i < b; ++i)
+			{
+				bigger->put(i, a->get(i));
+			}
+			arrays_.push_back(std::unique_ptr<Array>(bigger));
+			array_.store(bigger, std::memory_order_release);
+			return bigger;
+		}
+	private:
+		// thieves write top_, the owner bottom_; padded apart rather than aligned, the
+		// deque sits in heap objects and plain new ignores over-alignment before C++17
+		std::atomic<int64_t> top_;
+		char pad_[64];
+		std::atomic<int64_t> bottom_;
+		std::atomic<Array*> array_;
+		std::vector<std::unique_ptr<Array>> arrays_;			// owner only
+	};
+
+	/*
+	*	class Executor
+	*
+	*	Work stealing pool on ThreadStack. Each worker has a WorkDeque: tasks submitted
+	*	from a worker go to its own deque, tasks from other threads to a shared injection
+	*	queue, and an idle worker steals from the others before it sleeps. Waiting in
+	*	parallel_for runs tasks instead of blocking, so it may be called from a task.
+	*/
+	class Executor : public ThreadStack
+	{
+		class Task
+		{
+		public:
+			virtual ~Task() {}
+			virtual void run() = 0;
+		};
+		template <typename func>
+		class FuncTask : public Task
+		{
+		public:
+			explicit FuncTask(func&& f) : f_(std::move(f)) {}
+			void run() override { f_(); }
+		private:
+			func f_;
+		};
+		struct ForState;
+		class RangeTask;
+		struct Worker;
+	public:
+		/* threads == 0 starts one per hardware thread. */
+		explicit Executor(size_t threads = 0);
+		~Executor() override;
+	public:
+		/*
+		 * While the executor is not started, post and submit only queue: the tasks run
+		 * after the next start(), or are deleted unrun with it (a submit future then
+		 * gets broken_promise). parallel_for still works, the calling thread runs the
+		 * whole range. None of them may race with start() or stop().
+		 */
+		int start() { return Create(); }
+		/* Runs what is queued, then joins the workers. */
+		void stop() { Destroy(); }
+		size_t size() const { return nthreads_; }
+		template <typename func>
+		void post(func&& f)
+		{
+			using F = typename std::decay<func>::type;
+			schedule(new FuncTask<F>(F(std::forward<func>(f))));
+		}
+		template <typename func>
+		std::future<typename std::result_of<func()>::type> submit(func&& f)
+		{
+			using R = typename std::result_of<func()>::type;
+			std::packaged_task<R()> task(std::forward<func>(f));
+			std::future<R> result = task.get_future();
+			schedule(new FuncTask<std::packaged_task<R()>>(std::move(task)));
+			return result;
+		}
+		/*
+		 * f(i) for every i in [begin, end). The range is split in halves down to grain
+		 * (0 picks one) and idle workers steal the halves. Rethrows the first exception.
+		 */
+		template <typename func>
+		void parallel_for(size_t begin, size_t end, func&& f, size_t grain = 0)
+		{
+			std::function<void(size_t, size_t)> body = [&f](size_t b, size_t e) {
+				for (size_t i = b; i < e; ++i)
+				{
+					f(i);
+				}
+			};
+			run_for(begin, end, grain, body);
+		}
+	protected:
+		int OnCreate(size_t& thread_nums) override;
+		ThreadPlacement thread_placement() const override;
+		void OnDestroyed() override;
+		std::function<void()> add_thread(unsigned int thread_index) override;
+		void remove_thread(unsigned int index) override;
+		void wait_started(unsigned int index) override;
+	private:
+		void schedule(Task* task);
+		void wake_one();
+		Task* find_task(Worker* self);
+		bool has_work() const;
+		void run_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body);
+		void run_range(ForState* state, size_t begin, size_t end);
+		void work(Worker* w);
+	private:
+		size_t nthreads_;
+		std::vector<std::unique_ptr<Worker>> workers_;
+		std::mutex inject_lock_;
+		std::deque<Task*> inject_;
+		std::atomic<size_t> injected_;
+		std::mutex sleep_lock_;
+		std::condition_variable sleep_cond_;
+		std::atomic<int> sleepers_;
+		std::atomic_bool stop_;
+		static thread_local Worker* current_worker;
+	};
+}
+#endif // !TINY_EXECUTOR_H
@@ -18,8 +18,13 @@
 #define TINY_SPINLOCK_HPP
 
 #include <atomic>
+#include <cstdint>
 #include <mutex>
+#include <thread>
 #include <condition_variable>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 using lock_guard = std::lock_guard<std::mutex>;
 using unique_lock = std::unique_lock<std::mutex>;
 namespace tiny {
@@ -27,31 +32,179 @@ namespace tiny {
 
         class spinlock;
 
+        /* Tells the cpu we are spinning: frees the pipeline for the hyperthread sibling. */
+        inline void cpu_relax()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield" ::: "memory");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+            _mm_pause();
+#endif
+        }
+
+        /*
+         * Exponential backoff for spin loops: pause 1, 2, 4 .. 64 times between tries,
+         * and give the cpu away once the lock looks held by a preempted thread.
+         */
+        class spin_backoff
+        {
+            unsigned spins_ = 0;
+
+        public:
+            static const unsigned MAX_PAUSES = 64;
+            static const unsigned YIELD_AFTER = 16;
+
+            void pause() {
+                if (spins_ < YIELD_AFTER) {
+                    unsigned n = 1u << spins_;
+                    if (n > MAX_PAUSES)
+                        n = MAX_PAUSES;
+                    for (unsigned i = 0; i < n; ++i)
+                        cpu_relax();
+                    ++spins_;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            void reset() { spins_ = 0; }
+        };
+
         inline void spin_lock(std::atomic_flag& lock);
         inline void spin_unlock(std::atomic_flag& lock);
         inline void spin_lock(tiny::spinlock& lock);
         inline void spin_unlock(tiny::spinlock& lock);
 
-        /* A pre-packaged spinlock type modelling BasicLockable: */
+        /*
+         * A pre-packaged spinlock type modelling BasicLockable. Test and test-and-set:
+         * waiters spin on a plain load, which stays in their cache, and only try the
+         * exchange once the lock looks free, backing off in between.
+         */
         class spinlock final
         {
-            std::atomic_flag af = ATOMIC_FLAG_INIT;
+            std::atomic<bool> locked_{ false };
+
+        public:
+            void lock() {
+                spin_backoff backoff;
+                while (locked_.exchange(true, std::memory_order_acquire)) {
+                    do {
+                        backoff.pause();
+                    } while (locked_.load(std::memory_order_relaxed));
+                }
+            }
+
+            bool try_lock() {
+                return (!locked_.load(std::memory_order_relaxed) &&
+                    !locked_.exchange(true, std::memory_order_acquire));
+            }
+
+            void unlock() noexcept {
+                locked_.store(false, std::memory_order_release);
+            }
+        };
+
+        /*
+         * Fair spinlock: the lock is handed out in ticket order. Between looks at the
+         * lock a waiter pauses PAUSES_PER_WAITER times for each holder ahead of it;
+         * one that is not next in line yields after a while, a holder may be preempted.
+         */
+        class ticket_lock final
+        {
+            std::atomic<uint32_t> next_{ 0 };
+            char pad_[64];
+            std::atomic<uint32_t> serving_{ 0 };
 
         public:
+            static const uint32_t PAUSES_PER_WAITER = 4;
+
             void lock() {
-                tiny::spin_lock(af);
+                uint32_t ticket = next_.fetch_add(1, std::memory_order_relaxed);
+                unsigned rounds = 0;
+                for (;;) {
+                    uint32_t serving = serving_.load(std::memory_order_acquire);
+                    if (serving == ticket)
+                        return;
+                    uint32_t ahead = ticket - serving;
+                    if (ahead > 1 && ++rounds > spin_backoff::YIELD_AFTER) {
+                        std::this_thread::yield();
+                    } else {
+                        for (uint32_t i = 0; i < ahead * PAUSES_PER_WAITER; ++i)
+                            cpu_relax();
+                    }
+                }
             }
 
             void unlock() noexcept {
-                tiny::spin_unlock(af);
+                serving_.store(serving_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
             }
         };
 
+        /*
+         * MCS queue lock for heavily contended locks: each waiter spins on its own node,
+         * so a release touches one waiter's cache line instead of all of them. The node
+         * lives on the locker's stack, hence a guard instead of BasicLockable:
+         *
+         *     tiny::mcs_lock::guard g(lock);
+         */
+        class mcs_lock final
+        {
+        public:
+            struct node
+            {
+                std::atomic<node*> next{ nullptr };
+                std::atomic<bool> locked{ false };
+            };
+
+            class guard
+            {
+                mcs_lock& lock_;
+                node node_;
+
+            public:
+                explicit guard(mcs_lock& lock) : lock_(lock) { lock_.lock(node_); }
+                ~guard() { lock_.unlock(node_); }
+                guard(const guard&) = delete;
+                guard& operator = (const guard&) = delete;
+            };
+
+            void lock(node& me) {
+                me.next.store(nullptr, std::memory_order_relaxed);
+                me.locked.store(true, std::memory_order_relaxed);
+                node* prev = tail_.exchange(&me, std::memory_order_acq_rel);
+                if (prev) {
+                    prev->next.store(&me, std::memory_order_release);
+                    spin_backoff backoff;
+                    while (me.locked.load(std::memory_order_acquire))
+                        backoff.pause();
+                }
+            }
+
+            void unlock(node& me) noexcept {
+                node* next = me.next.load(std::memory_order_acquire);
+                if (!next) {
+                    node* expected = &me;
+                    if (tail_.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel))
+                        return;
+                    // a successor swapped tail_ but has not linked itself yet
+                    spin_backoff backoff;
+                    while ((next = me.next.load(std::memory_order_acquire)) == nullptr)
+                        backoff.pause();
+                }
+                next->locked.store(false, std::memory_order_release);
+            }
+
+        private:
+            std::atomic<node*> tail_{ nullptr };
+        };
+
         // Free functions:
         inline void spin_lock(std::atomic_flag& lock)
         {
+            spin_backoff backoff;
             while (lock.test_and_set(std::memory_order_acquire))
-                ;
+                backoff.pause();
         }
 
         inline void spin_unlock(std::atomic_flag& lock)
@@ -7,8 +7,12 @@
 #include "tiny_locker.h"
 #include <unordered_map>
 #include <atomic>
+#include <functional>
+#include <type_traits>
 namespace tiny
 {
+    class LogFormat;
+    class LogRateLimit;
     class Entry {
     public:
 
@@ -17,7 +21,9 @@ namespace tiny
             m_stamp(utime_t::now()),
             m_thread(Thread::posix_this_thread_id()),
             m_prio(pri),
-            m_subsys(subsys)
+            m_subsys(subsys),
+            m_format(nullptr),
+            m_limit(nullptr)
         {}
         Entry(const Entry&) = default;
         Entry& operator=(const Entry&) = default;
@@ -32,6 +38,10 @@ namespace tiny
         unsigned long m_thread;
         short m_prio;
         int m_subsys;
+        /* Set for deferred entries: strv() holds encoded arguments of this format. */
+        const LogFormat* m_format;
+        /* Set by dout_limit_impl: the call site's rate limit, checked before queueing. */
+        LogRateLimit* m_limit;
     };
 
     /* This should never be moved to the heap! Only allocate this on the stack. See
@@ -62,53 +72,378 @@ namespace tiny
         CachedStackStringStream cos;
     };
 
+    /*
+    *   class LogFormat
+    *
+    *   printf style format of a dlog_impl call site, parsed once. The arguments are
+    *   captured as tagged raw bytes by DeferredEntry and only turned into text on
+    *   the logger thread.
+    */
+    class LogFormat
+    {
+    public:
+        enum ArgType
+        {
+            arg_int = 1,
+            arg_uint,
+            arg_double,
+            arg_str,
+            arg_ptr,
+        };
+    public:
+        explicit LogFormat(const char* fmt);
+        LogFormat(const LogFormat&) = delete;
+        LogFormat& operator = (const LogFormat&) = delete;
+    public:
+        /* Appends the text of one entry, args as written by DeferredEntry. */
+        void format(stringview args, std::vector<char>& out) const;
+        const char* fmt() const { return fmt_; }
+    private:
+        struct Spec
+        {
+            size_t literal_begin;   // text before the conversion, %% already folded
+            size_t literal_end;
+            std::string flags;      // flags and width, without '%'
+            bool star_width;        // '*' width, taken from an int argument
+            bool star_precision;    // ".*" precision, likewise
+            int precision;          // -1 if none
+            char conv;              // 0 for the trailing literal
+        };
+    private:
+        const char* fmt_;
+        std::string literals_;
+        std::vector<Spec> specs_;
+    };
+
+    /* This should never be moved to the heap! Only allocate this on the stack. */
+    class DeferredEntry : public Entry {
+    public:
+        DeferredEntry() = delete;
+        DeferredEntry(short pri, int subsys, const LogFormat& fmt)
+            : Entry(pri, subsys)
+            , len(0)
+        {
+            m_format = &fmt;
+        }
+        DeferredEntry(const DeferredEntry&) = delete;
+        DeferredEntry& operator=(const DeferredEntry&) = delete;
+        ~DeferredEntry() override = default;
+
+        stringview strv() const override {
+            return stringview(data(), len);
+        }
+        std::size_t size() const override {
+            return len;
+        }
+
+        void encode() {}
+        template<typename T, typename... Args>
+        void encode(const T& v, const Args&... args) {
+            put(v);
+            encode(args...);
+        }
+
+    private:
+        const char* data() const {
+            return (heap.empty() ? buf : heap.data());
+        }
+        void append(const void* p, size_t n) {
+            if (heap.empty() && (len + n) <= sizeof(buf)) {
+                maybe_inline_memcpy(buf + len, p, n, 16);
+            }
+            else {
+                if (heap.empty()) {
+                    heap.assign(buf, buf + len);
+                }
+                heap.insert(heap.end(), (const char*)p, (const char*)p + n);
+            }
+            len += n;
+        }
+        void put_tag(LogFormat::ArgType t) {
+            char c = (char)t;
+            append(&c, 1);
+        }
+        void put_str(const char* s, size_t n) {
+            uint32_t l = (uint32_t)n;
+            put_tag(LogFormat::arg_str);
+            append(&l, sizeof(l));
+            append(s, n);
+        }
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type put(const T& v) {
+            int64_t i = v;
+            put_tag(LogFormat::arg_int);
+            append(&i, sizeof(i));
+        }
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type put(const T& v) {
+            uint64_t u = v;
+            put_tag(LogFormat::arg_uint);
+            append(&u, sizeof(u));
+        }
+        template<typename T>
+        typename std::enable_if<std::is_enum<T>::value>::type put(const T& v) {
+            put(static_cast<int64_t>(v));
+        }
+        template<typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type put(const T& v) {
+            double d = v;
+            put_tag(LogFormat::arg_double);
+            append(&d, sizeof(d));
+        }
+        template<typename T>
+        typename std::enable_if<std::is_pointer<T>::value>::type put(const T& v) {
+            uint64_t p = (uint64_t)(uintptr_t)v;
+            put_tag(LogFormat::arg_ptr);
+            append(&p, sizeof(p));
+        }
+        void put(const char* s) {
+            if (!s) {
+                s = "(null)";
+            }
+            put_str(s, strlen(s));
+        }
+        void put(char* s) {
+            put((const char*)s);
+        }
+        void put(const std::string& s) {
+            put_str(s.data(), s.size());
+        }
+        void put(const stringview& s) {
+            put_str(s.data(), s.size());
+        }
+
+    private:
+        char buf[256];
+        std::vector<char> heap;
+        size_t len;
+    };
+
+    /*
+    *   class LogArena
+    *
+    *   Pre-allocated fixed size chunks shared by all producer threads. Each thread
+    *   bump-allocates from its own current chunk, a chunk goes back to the free
+    *   list once its thread moved on and every entry that points into it has been
+    *   written out. When the free list is empty, a chunk of a thread that holds one
+    *   but has nothing in flight is taken away from it, so idle threads don't pin
+    *   the pool. The creator and every thread that used the arena hold a reference;
+    *   close() drops the creator's and the last one frees it.
+    */
+    class LogArena
+    {
+    public:
+        struct Chunk;
+    public:
+        LogArena(size_t chunk_size, size_t chunks);
+        LogArena(const LogArena&) = delete;
+        LogArena& operator = (const LogArena&) = delete;
+    public:
+        /* Returns nullptr when len does not fit a chunk or all chunks are in use. */
+        char* reserve(size_t len, Chunk** chunk);
+        static void release(Chunk* chunk);
+        size_t chunk_size() const { return chunk_size_; }
+        void close() { unref(); }
+    private:
+        ~LogArena();
+        Chunk* acquire(uint32_t* gen);
+        Chunk* steal(uint32_t* gen);
+        void recycle(Chunk* chunk);
+        static void disown(Chunk* chunk, uint32_t gen);
+        void ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+        void unref();
+        friend struct LogArenaCursor;
+    private:
+        size_t chunk_size_;
+        std::vector<Chunk*> chunks_;
+        std::vector<Chunk*> free_;
+        spinlock free_lock_;
+        std::atomic<long> refs_;
+    };
+
     class ConcreteEntry : public Entry {
     public:
         ConcreteEntry() = delete;
-        ConcreteEntry(const Entry& e) : Entry(e) {
+        ConcreteEntry(const Entry& e) : Entry(e), chunk(nullptr) {
             auto strv = e.strv();
             str.reserve(strv.size());
             str.insert(str.end(), strv.begin(), strv.end());
         }
+        /* Copies the message into the arena, falls back to the heap when it is exhausted. */
+        ConcreteEntry(const Entry& e, LogArena& arena) : Entry(e), chunk(nullptr) {
+            auto strv = e.strv();
+            char* pos = arena.reserve(strv.size(), &chunk);
+            if (pos) {
+                maybe_inline_memcpy(pos, strv.data(), strv.size(), 64);
+                ext = stringview(pos, strv.size());
+            }
+            else {
+                str.assign(strv.begin(), strv.end());
+            }
+        }
         ConcreteEntry& operator=(const Entry& e) {
             Entry::operator=(e);
             auto strv = e.strv();
             str.reserve(strv.size());
             str.assign(strv.begin(), strv.end());
+            reset_chunk();
             return *this;
         }
         ConcreteEntry(ConcreteEntry&& e) noexcept
-            : Entry(e), str(std::move(e.str))
+            : Entry(e), str(std::move(e.str)), chunk(e.chunk), ext(e.ext)
         {
+            e.chunk = nullptr;
+            e.ext.clear();
         }
         ConcreteEntry& operator=(ConcreteEntry&& e) noexcept
         {
             Entry::operator=(e);
             str = std::move(e.str);
+            std::swap(chunk, e.chunk);
+            std::swap(ext, e.ext);
             return *this;
         }
-        ~ConcreteEntry() override = default;
+        ~ConcreteEntry() override {
+            reset_chunk();
+        }
 
         stringview strv() const override {
+            if (chunk) {
+                return ext;
+            }
             return stringview(str.data(), str.size());
         }
         std::size_t size() const override {
-            return str.size();
+            return (chunk ? ext.size() : str.size());
+        }
+        /* Hands the arena reference over to the caller, the message stays valid until it is released. */
+        LogArena::Chunk* detach_chunk() {
+            LogArena::Chunk* c = chunk;
+            chunk = nullptr;
+            return c;
         }
+        bool in_arena() const { return (chunk != nullptr); }
 
+    private:
+        void reset_chunk() {
+            if (chunk) {
+                LogArena::release(chunk);
+                chunk = nullptr;
+            }
+            ext.clear();
+        }
     private:
         std::vector<char> str;
+        LogArena::Chunk* chunk;
+        stringview ext;
+    };
+
+
+    /*
+    *   class LogHeaderFormatter
+    *
+    *   Writes the "<date time>.<usec> <subsys> thread id(0x..), log level(..) " prefix
+    *   of a log line. The date and time are formatted once per second and reused,
+    *   the remaining fields are written by hand instead of through snprintf.
+    */
+    class LogHeaderFormatter
+    {
+    public:
+        static const size_t HEADER_RESERVE = 128;   // header bytes besides the subsystem name
+    public:
+        LogHeaderFormatter();
+    public:
+        /* Returns the header length, the same text as utime_t::snprintf_t plus the old snprintf. */
+        size_t format(char* buf, size_t len, const utime_t& stamp, const std::string& name, unsigned long thread, int prio);
+    private:
+        time_t cached_sec_;
+        char date_[64];
     };
 
+    /*
+    *   class LogSubsys
+    *
+    *   A subsystem as seen from one dout call site: looked up once, after that
+    *   filtering a message only loads its gather threshold.
+    */
+    class LogSubsys
+    {
+    public:
+        explicit LogSubsys(const char* name);
+        LogSubsys(const LogSubsys&) = delete;
+        LogSubsys& operator = (const LogSubsys&) = delete;
+    public:
+        bool should_gather(int pri) const { return (pri < threshold_->load(std::memory_order_relaxed)); }
+        int index() const { return index_; }
+    private:
+        int index_;
+        const std::atomic_int* threshold_;
+    };
+
+    /*
+    *   class LogRateLimit
+    *
+    *   State of one rate limited call site. A token bucket lets burst entries through
+    *   at once and per_sec after that; a message equal to the previous one is only
+    *   counted for a second. The next entry let through reports what was dropped;
+    *   if none comes, the idle logger thread reports it once the call site has been
+    *   quiet for a second, and Logger stop reports what is left.
+    */
+    class LogRateLimit
+    {
+    public:
+        LogRateLimit(unsigned per_sec, unsigned burst);
+        ~LogRateLimit();
+        LogRateLimit(const LogRateLimit&) = delete;
+        LogRateLimit& operator = (const LogRateLimit&) = delete;
+    public:
+        /* Takes a token; checked before the message is formatted. */
+        bool admit();
+        /* Whether the formatted entry is queued, and how many were dropped before it. */
+        bool pass(const Entry& e, uint64_t* repeated, uint64_t* suppressed);
+        /*
+         * Takes the counts no entry reported yet, once the call site has been quiet
+         * for a second or always if all; false if there is nothing to report.
+         */
+        bool take_pending(bool all, short* prio, int* subsys, uint64_t* repeated, uint64_t* suppressed);
+    private:
+        int64_t interval_;
+        int64_t burst_;
+        std::atomic<int64_t> tat_;          // theoretical arrival time of the next entry
+        std::atomic<uint64_t> suppressed_;
+        spinlock lock_;
+        uint64_t last_hash_;
+        int64_t last_pass_;
+        uint64_t repeated_;
+        short last_prio_;
+        int last_subsys_;                   // -1 until an entry got to pass
+    };
 
     class SubsysMap;
+    class LogSink;
+    class IniFile;
+    class FlightRecorder;
     class OnAppExitManager;
+    struct LoggerRingHolder;
 	class Logger
 	{
         using EntryVector = std::vector<ConcreteEntry>;
         static const std::size_t DEFAULT_MAX_NEW = 100;
         static const std::size_t DEFAULT_ENTRY_BUFFER_SIZE = 4096;
+        class EntryRing;
     public:
+        /* What a producer does when its per-thread ring is full. */
+        enum class OverflowPolicy
+        {
+            block,              // wait for the logger thread to drain the ring
+            drop_newest,        // discard the entry being submitted
+            drop_oldest,        // discard the oldest queued entry of this thread
+        };
+        /*
+         * Write, WriteV and Idle are called on the logger thread only. Print is too,
+         * unless set_async_print() is used: then it is called on the print thread,
+         * concurrently with the others, and must not touch state they use.
+         */
         class WriterImpl
         {
         public:
@@ -116,6 +451,20 @@ namespace tiny
         public:
             virtual void Write(const char* data, size_t len) = 0;
             virtual void Print(const char* data, size_t len) = 0;
+            /* Writes a batch of buffers as one logical write. */
+            virtual void WriteV(const stringview* bufs, size_t count)
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    Write(bufs[i].data(), bufs[i].size());
+                }
+            }
+            /*
+             * Called on the logger thread before it parks with nothing to write.
+             * Returns in how many milliseconds it wants to be called again even if
+             * no entry arrives, 0 for not at all.
+             */
+            virtual unsigned Idle() { return 0; }
         };
 	private:
 		Logger();
@@ -123,14 +472,82 @@ namespace tiny
     public:
         static Logger* Instance();
     public:
+        /*
+         * Without writer_impl, path is written by a default writer that every save_days
+         * renames it to "<path>.<yyyymmdd-hhmmss>" and keeps the previous period gzipped.
+         */
         int initialize(int save_days, const std::string& path, std::unique_ptr<WriterImpl> writer_impl = std::unique_ptr<WriterImpl>());
         void submit_entry(Entry&& e);
+        template<typename... Args>
+        void submit_deferred(short pri, int subsys, const LogFormat& fmt, const Args&... args)
+        {
+            DeferredEntry e(pri, subsys, fmt);
+            e.encode(args...);
+            submit_entry(std::move(e));
+        }
         int should_gather_log(const std::string& n, int pri);
+        /* Index of subsystem n and the threshold its messages are gathered below. */
+        const std::atomic_int* resolve_subsys(const std::string& n, int* index);
         void set_log_gather(const std::string& subsys, int gather);
         void set_log_level(const std::string& subsys, int level);
+        /* Registers subsys on first use; there is no limit on the number of subsystems. */
         void set_log_subsys(const std::string& subsys, int log_level, int gather_level);
         void set_log_level(int l);
         void set_gather_level(int g);
+        /*
+         * Called after levels change, with the new values; subsys is empty for the global
+         * levels. Observers run on the changing thread without a lock held, so they may
+         * change levels themselves.
+         */
+        using LevelObserver = std::function<void(const std::string& subsys, int level, int gather)>;
+        void add_level_observer(LevelObserver observer);
+        /*
+         * Apply a section of an IniFile on a live process, one "subsys = level[,gather]"
+         * per key (gather defaults to level); the keys log_level and gather_level set
+         * the global levels. Returns the number of keys applied, -1 if there is no such
+         * section.
+         */
+        int load_log_levels(const IniFile& ini, const std::string& section = "log");
+        /*
+         * Switch submit_entry from the shared locked queue to one bounded SPSC ring
+         * per producer thread, drained by the logger thread. Must be called before
+         * initialize(); entries == 0 restores the shared queue.
+         */
+        int set_thread_ring(size_t entries, OverflowPolicy policy = OverflowPolicy::block);
+        uint64_t get_dropped_entries() const { return dropped_entries_.load(std::memory_order_relaxed); }
+        /*
+         * Copy submitted messages into a pre-allocated arena of chunks instead of a
+         * heap buffer per entry; the logger thread writes them out from there
+         * without copying them again. Must be called before initialize().
+         */
+        int set_log_arena(size_t chunk_size, size_t chunks);
+        /*
+         * Register another sink, fed on a thread of its own with every kept entry of
+         * priority <= level. Up to queue_bytes of formatted lines wait for it, beyond
+         * that lines are dropped for this sink only, so a slow sink never holds back
+         * the main writer or the producers. Must be called before initialize();
+         * returns the sink index. A sink only sees entries the subsystem and global
+         * levels already let through, so level can narrow them but not widen them.
+         */
+        int add_sink(std::unique_ptr<WriterImpl> sink, int level, size_t queue_bytes = 1 << 20);
+        uint64_t get_sink_dropped(int sink) const;
+        /*
+         * Hand the main writer's Print calls to a thread of their own with a bounded
+         * queue, so a blocking console doesn't stall the file. Print then runs
+         * concurrently with Write, see WriterImpl. Must be called before initialize().
+         */
+        int set_async_print(size_t queue_bytes = 1 << 20);
+        /*
+         * Keep the last slots entries of priority <= level in a lock-free in-memory
+         * ring, including entries the subsystem levels filter out; each message is
+         * cut at slot_size bytes. The ring is written to dump_path when tiny_assert
+         * or tiny_abort fails, on a fatal signal if catch_signals, or by
+         * dump_flight_recorder(); a crash is dumped once, and the handlers that
+         * were installed for those signals still run after it. Call it once,
+         * before initialize().
+         */
+        int set_flight_recorder(size_t slots, size_t slot_size, int level, const std::string& dump_path, bool catch_signals = true);
+        int dump_flight_recorder();
         bool in_thread() const { return (std::this_thread::get_id() == owner_); }
 	protected:
         int start();
@@ -138,8 +555,20 @@ namespace tiny
         void run();
     private:
         void flush(EntryVector& t);
+        void write_log_buf();
+        void enqueue_entry(ConcreteEntry&& e);
+        EntryRing* local_ring();
+        void submit_to_ring(ConcreteEntry&& e);
+        size_t drain_rings(EntryVector& t);
+        void run_rings();
+        void print_line(const stringview* parts, size_t count);
+        void route_sinks(short prio, const stringview* parts, size_t count);
+        void notify_level_change(const std::string& subsys);
+        void add_rate_limit(LogRateLimit* limit);
+        void remove_rate_limit(LogRateLimit* limit);
+        bool flush_rate_limits(bool all);
 	private:
-        bool to_stop_;
+        std::atomic_bool to_stop_;       // read by run_rings without the lock
         bool started_;
         std::atomic_int m_gather_level_;
         std::atomic_int m_log_level_;
@@ -151,11 +580,97 @@ namespace tiny
         std::condition_variable flush_entry_cond_;
         EntryVector new_entries_;
         std::vector<char> m_log_buf;
+        /* Arena messages waiting in the batch, in order between m_log_buf pieces. */
+        struct PendingPiece
+        {
+            size_t buf_end;
+            stringview ext;
+            LogArena::Chunk* chunk;
+        };
+        std::vector<PendingPiece> m_pending;
+        std::vector<stringview> m_iov;
+        std::vector<char> m_print_buf;
+        std::vector<char> m_format_buf;
+        LogHeaderFormatter m_header;
+        size_t m_pending_bytes;
+        LogArena* arena_;
         std::unique_ptr<WriterImpl> writer_impl_;
+        std::vector<std::unique_ptr<LogSink>> sinks_;
+        std::unique_ptr<LogSink> print_sink_;
+        size_t print_queue_bytes_;
+        FlightRecorder* recorder_;
+        std::mutex observers_mutex_;
+        std::vector<LevelObserver> observers_;
+        std::mutex limits_mutex_;
+        std::vector<LogRateLimit*> limits_;
         std::thread thread_;
         std::thread::id owner_;
+        size_t ring_entries_;
+        OverflowPolicy ring_policy_;
+        std::atomic<uint64_t> dropped_entries_;
+        std::atomic_bool consumer_parked_;
+        std::atomic_int blocked_producers_;
+        std::mutex rings_mutex_;
+        std::vector<std::shared_ptr<EntryRing>> rings_;
         friend class OnAppExitManager;
+        friend class LogRateLimit;
+        friend struct LoggerRingHolder;
 	};
+
+    class LogRotateWorker;
+    /*
+    *   class AppendLogWriterImpl
+    *
+    *   Writes to a raw O_APPEND descriptor, a whole batch from Logger::flush goes out
+    *   with one writev. The data is synced to disk every sync_bytes written and/or
+    *   every sync_ms milliseconds, also when no more is written after a burst; with
+    *   both 0 it is left to the kernel.
+    */
+    class AppendLogWriterImpl : public Logger::WriterImpl
+    {
+    public:
+        AppendLogWriterImpl(const std::string& path, size_t sync_bytes = 0, unsigned sync_ms = 0, bool print = true);
+        ~AppendLogWriterImpl() override;
+        AppendLogWriterImpl(const AppendLogWriterImpl&) = delete;
+        AppendLogWriterImpl& operator = (const AppendLogWriterImpl&) = delete;
+    public:
+        void Write(const char* data, size_t len) override;
+        void WriteV(const stringview* bufs, size_t count) override;
+        void Print(const char* data, size_t len) override;
+        unsigned Idle() override;
+        const std::string& path() const { return path_; }
+        /*
+         * Roll the file over to "<path>.<yyyymmdd-hhmmss>" once it reaches max_bytes
+         * and/or at every full hour, keeping the newest keep_files segments (0 keeps
+         * all). compress_cmd, e.g. "gzip", is run on each rotated segment and must
+         * replace it; compression and pruning run on a background thread. Call it
+         * before the writer is handed to the Logger.
+         */
+        void set_rotation(size_t max_bytes, bool hourly, unsigned keep_files = 0, const std::string& compress_cmd = "gzip");
+    protected:
+        bool open_file();
+        void close_file();
+        void sync_file(size_t written);
+        void sync_now(time_detail::mono_clock::time_point now);
+        bool should_rotate() const;
+        void rotate();
+    private:
+        std::string path_;
+        int fd_;
+        size_t sync_bytes_;
+        unsigned sync_ms_;
+        const bool print_;          // all Print reads, it may run on the print thread
+        size_t unsynced_;
+        time_detail::mono_clock::time_point last_sync_;
+        size_t rotate_bytes_;
+        bool rotate_hourly_;
+        unsigned keep_files_;
+        std::string compress_cmd_;
+        size_t file_size_;
+        time_t opened_at_;
+        time_t next_hour_;
+        std::unique_ptr<LogRotateWorker> rotate_worker_;
+    };
 }
 
 
@@ -176,9 +691,24 @@ namespace tiny
 /// 
 #define dout_impl(pri, subsys)										                                    \
 		do {                                                                                            \
-			int subsys_index = tiny::Logger::Instance()->should_gather_log(#subsys, pri);               \
-			if (subsys_index >= 0) {                                                                    \
-				tiny::MutableEntry _dout_e(pri, subsys_index);                                          \
+			static const tiny::LogSubsys _dout_subsys(#subsys);                                         \
+			if (_dout_subsys.should_gather(pri)) {                                                      \
+				tiny::MutableEntry _dout_e(pri, _dout_subsys.index());                                  \
+				std::ostream* _dout = &_dout_e.get_ostream();                                           \
+				*_dout
+
+/*
+ * dout_impl for a call site that may fire in a storm, e.g. on every failed query:
+ * at most burst entries at once and per_sec after that, and a run of identical
+ * messages becomes "last message repeated N times".
+ */
+#define dout_limit_impl(pri, subsys, per_sec, burst)                                                    \
+		do {                                                                                            \
+			static const tiny::LogSubsys _dout_subsys(#subsys);                                         \
+			static tiny::LogRateLimit _dout_limit(per_sec, burst);                                      \
+			if (_dout_subsys.should_gather(pri) && _dout_limit.admit()) {                               \
+				tiny::MutableEntry _dout_e(pri, _dout_subsys.index());                                  \
+				_dout_e.m_limit = &_dout_limit;                                                         \
 				std::ostream* _dout = &_dout_e.get_ostream();                                           \
 				*_dout
 
@@ -189,5 +719,21 @@ namespace tiny
 
 #define dendl					dendl_impl
 
+/*
+ * Deferred formatting: only the arguments are copied on the calling thread, the
+ * logger thread formats them. The format is never freed, entries still queued at
+ * exit refer to it. fmt must be a string literal, e.g.
+ *      #define ldlog(v, ...)   dlog_impl(v, subsys_name, __VA_ARGS__)
+ *      ldlog(10, "request %s took %d us", name, cost);
+ */
+#define dlog_impl(pri, subsys, fmt, ...)                                                           \
+		do {                                                                                            \
+			static const tiny::LogSubsys _dout_subsys(#subsys);                                         \
+			if (_dout_subsys.should_gather(pri)) {                                                      \
+				static const tiny::LogFormat& _dlog_fmt = *new tiny::LogFormat(fmt);                    \
+				tiny::Logger::Instance()->submit_deferred(pri, _dout_subsys.index(), _dlog_fmt, ##__VA_ARGS__); \
+			}                                                                                           \
+		} while (0)
+
 
 #endif // !TINY_LOGGER_H
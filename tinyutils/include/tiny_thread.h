@@ -5,9 +5,31 @@
 #include "tiny_locker.h"
 #include <thread>
 #include <vector>
+#include <string>
 #include <functional>
 namespace tiny
 {
+	/*
+	*	struct ThreadPlacement
+	*
+	*	Where and how a thread runs, applied by the thread itself before its body. A
+	*	part that fails or the platform lacks is reported and skipped.
+	*/
+	struct ThreadPlacement
+	{
+		ThreadPlacement() : cpu_per_thread(false), numa_local(false), fifo_priority(0) {}
+
+		std::string name;					// pthread_setname_np, a ThreadStack appends "-index"; 15 chars kept
+		std::vector<int> cpus;				// affinity, empty leaves it alone
+		bool cpu_per_thread;				// ThreadStack worker i only gets cpus[i % cpus.size()]
+		bool numa_local;					// memory from the node of the cpu it runs on (MPOL_LOCAL), pin as well
+		int fifo_priority;					// SCHED_FIFO at this priority when > 0, needs CAP_SYS_NICE
+
+		int apply(int index = -1) const;
+		/* The cpus of a NUMA node, from sysfs; empty if there is no such node. */
+		static std::vector<int> cpus_of_node(int node);
+	};
+
 	class Thread
 	{
 	public:
@@ -25,6 +47,8 @@ namespace tiny
 		void stop();
 		void join();
 		std::thread::id thread_id() const { return owner_; }
+		/* Takes effect at the next start. */
+		void set_placement(const ThreadPlacement& placement) { placement_ = placement; }
 	public:
 		static unsigned long posix_this_thread_id();
 	protected:
@@ -36,6 +60,7 @@ namespace tiny
 	private:
 		std::thread thread_;
 		std::thread::id owner_;
+		ThreadPlacement placement_;
 	};
 
 	class ThreadStack
@@ -89,8 +114,13 @@ namespace tiny
 		virtual void OnCreated() {}
 		virtual void OnDestroy() {}
 		virtual void OnDestroyed() {}
+		/* What the threads of Create are placed by; a subclass may fill in what placement leaves unset. */
+		virtual ThreadPlacement thread_placement() const { return placement; }
 	public:
 		size_t get_thread_numbers() const { return threads.size(); }
+		/* Takes effect at the next Create, see thread_placement. */
+		void set_placement(const ThreadPlacement& placement) { this->placement = placement; }
+		const ThreadPlacement& get_placement() const { return placement; }
 	public:
 		virtual std::function<void()> add_thread(unsigned int thread_index) = 0;
 		virtual void remove_thread(unsigned int index) = 0;
@@ -99,6 +129,8 @@ namespace tiny
 		bool started;
 		std::mutex stack_lock;
 		std::vector<std::thread> threads;
+	protected:
+		ThreadPlacement placement;
 	};
 }
 #endif // !TINY_THREAD_H
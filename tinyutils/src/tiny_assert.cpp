@@ -1,6 +1,7 @@
 #include "tiny_assert.h"
 #include <string.h>
 #include <stdarg.h>
+#include <atomic>
 #ifdef UNI_WIN
 #include <Windows.h>
 std::string cpp_strerror(int err)
@@ -72,6 +73,22 @@ namespace tiny
 
 
 
+	static std::atomic<tiny_abort_hook_t> abort_hook(nullptr);
+
+	void set_tiny_abort_hook(tiny_abort_hook_t hook)
+	{
+		abort_hook.store(hook);
+	}
+
+	static void run_abort_hook()
+	{
+		tiny_abort_hook_t hook = abort_hook.exchange(nullptr);
+		if (hook)
+		{
+			hook();
+		}
+	}
+
 #define	ERROR_INFO_BUFFER_MAX_SIZE				8096
 	void __tiny_assert_fail(const char* assertion, const char* file, int line, const char* function)
 	{
@@ -84,11 +101,13 @@ namespace tiny
 
 #   if defined(_MSC_VER)
 		std::cout << sb.str() << std::endl;
+		run_abort_hook();
 		__debugbreak();
 #   elif defined (ANDROID_NDK)
 		__android_log_assert("assert", "grinliz", "%s", sb.str());
 #else
 		std::cout << sb.str() << std::endl;
+		run_abort_hook();
 		abort();
 #endif
 	}
@@ -111,11 +130,13 @@ namespace tiny
 		va_end(args);
 #   if defined(_MSC_VER)
 		std::cout << sb.str() << std::endl;
+		run_abort_hook();
 		__debugbreak();
 #   elif defined (ANDROID_NDK)
 		__android_log_assert("assert", "grinliz", "%s", sb.str());
 #else
 		std::cout << sb.str() << std::endl;
+		run_abort_hook();
 		abort();
 #endif
 	}
@@ -139,11 +160,13 @@ namespace tiny
 			file, line, msg.c_str());
 #   if defined(_MSC_VER)
 		std::cout << sb.str() << std::endl;
+		run_abort_hook();
 		__debugbreak();
 #   elif defined (ANDROID_NDK)
 		__android_log_assert("assert", "grinliz", "%s", sb.str());
 #else
 		std::cout << sb.str() << std::endl;
+		run_abort_hook();
 		abort();
 #endif
 	}
@@ -163,11 +186,13 @@ namespace tiny
 		va_end(args);
 #   if defined(_MSC_VER)
 		std::cout << sb.str() << std::endl;
+		run_abort_hook();
 		__debugbreak();
 #   elif defined (ANDROID_NDK)
 		__android_log_assert("assert", "grinliz", "%s", sb.str());
 #else
 		std::cout << sb.str() << std::endl;
+		run_abort_hook();
 		abort();
 #endif
 	}
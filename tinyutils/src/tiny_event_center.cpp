@@ -1,18 +1,465 @@
 #include "tiny_event_center.h"
+#include <string.h>
 
 #ifdef UNI_WIN
 #include <WinSock2.h>
+#else
+#include "tiny_event_epoll.h"
+#include "tiny_event_uring.h"
+#include <unistd.h>
+#include <sys/eventfd.h>
 #endif // UNI_WIN
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <climits>
+#endif // __linux__
 
 namespace tiny
 {
+	/*
+	*	class SubmitNode
+	*/
+
+	/*
+	* Nodes of one submitting thread. Nodes run by a loop come back through a lock-free
+	* stack that only the owner empties, all at once; the pool goes away when its thread
+	* is gone and no node of it is in flight.
+	*/
+	class SubmitNode::Pool
+	{
+	public:
+		Pool()
+			: free_(nullptr)
+			, returned_(nullptr)
+			, refs_(1)
+		{
+		}
+		~Pool()
+		{
+			drop(free_);
+			drop(returned_.load());
+		}
+	public:
+		static Pool* local()
+		{
+			struct Holder
+			{
+				Holder() : pool(new Pool) {}
+				~Holder() { pool->release(); }
+				Pool* pool;
+			};
+			static thread_local Holder holder;
+			return holder.pool;
+		}
+		SubmitNode* get()
+		{
+			if (!free_)
+			{
+				free_ = returned_.exchange(nullptr, std::memory_order_acquire);
+			}
+			SubmitNode* n = free_;
+			if (n)
+			{
+				free_ = n->pool_next_;
+			}
+			else
+			{
+				n = new SubmitNode;
+				n->pool_ = this;
+			}
+			refs_.fetch_add(1, std::memory_order_relaxed);
+			return n;
+		}
+		void put_local(SubmitNode* n)
+		{
+			n->pool_next_ = free_;
+			free_ = n;
+			release();
+		}
+		void put_remote(SubmitNode* n)
+		{
+			SubmitNode* head = returned_.load(std::memory_order_relaxed);
+			do
+			{
+				n->pool_next_ = head;
+			} while (!returned_.compare_exchange_weak(head, n, std::memory_order_release, std::memory_order_relaxed));
+			release();
+		}
+		void release()
+		{
+			if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				delete this;
+			}
+		}
+	private:
+		static void drop(SubmitNode* n)
+		{
+			while (n)
+			{
+				SubmitNode* next = n->pool_next_;
+				delete n;
+				n = next;
+			}
+		}
+	private:
+		SubmitNode* free_;
+		std::atomic<SubmitNode*> returned_;
+		std::atomic<long> refs_;
+	};
+
+	static void submit_futex_wait(std::atomic<uint32_t>* addr, uint32_t val)
+	{
+#ifdef __linux__
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, val, nullptr, nullptr, 0);
+#else
+		std::this_thread::yield();
+#endif // __linux__
+	}
+	static void submit_futex_wake(std::atomic<uint32_t>* addr)
+	{
+#ifdef __linux__
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif // __linux__
+	}
+
+	SubmitNode::SubmitNode()
+		: target_(nullptr)
+		, invoke_(nullptr)
+		, destroy_(nullptr)
+		, sync_(false)
+		, done_(0)
+		, pool_(nullptr)
+		, pool_next_(nullptr)
+	{
+	}
+	SubmitNode* SubmitNode::acquire()
+	{
+		return Pool::local()->get();
+	}
+	void SubmitNode::do_request(uint64_t id)
+	{
+		invoke_(target_);
+		destroy_(target_);
+		if (sync_)
+		{
+			// the submitter takes it back, the node may be reused as soon as done_ is seen
+			done_.store(1, std::memory_order_release);
+			submit_futex_wake(&done_);
+		}
+		else
+		{
+			pool_->put_remote(this);
+		}
+	}
+	void SubmitNode::wait_and_release()
+	{
+		for (int spin = 0; done_.load(std::memory_order_acquire) == 0; ++spin)
+		{
+			if (spin >= 100)
+			{
+				submit_futex_wait(&done_, 0);
+			}
+		}
+		pool_->put_local(this);
+	}
+
+	/*
+	*	class EventCenterStats
+	*/
+
+	EventCenterStats::EventCenterStats()
+		: iterations_(0)
+		, wait_ns_(0)
+		, callback_ns_(0)
+		, callbacks_(0)
+		, time_events_fired_(0)
+		, external_processed_(0)
+		, external_pushed_(0)
+		, running_since_(0)
+		, slowest_seq_(0)
+		, slowest_ns_(0)
+		, slowest_function_(nullptr)
+		, slowest_file_line_(nullptr)
+	{
+		for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+		{
+			histogram_[i].store(0, std::memory_order_relaxed);
+		}
+	}
+	uint64_t EventCenterStats::external_depth() const
+	{
+		uint64_t processed = external_processed_.load(std::memory_order_relaxed);
+		uint64_t pushed = external_pushed_.load(std::memory_order_relaxed);
+		return (pushed > processed ? pushed - processed : 0);
+	}
+	uint64_t EventCenterStats::running_for_ns() const
+	{
+		uint64_t since = running_since_.load(std::memory_order_relaxed);
+		if (since == 0)
+		{
+			return 0;
+		}
+		uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(EventCenter::clock_type::now().time_since_epoch()).count();
+		return (now > since ? now - since : 0);
+	}
+	uint64_t EventCenterStats::slowest_callback(Location* where) const
+	{
+		uint32_t seq;
+		uint64_t ns;
+		const char* function;
+		const char* file_line;
+		do
+		{
+			seq = slowest_seq_.load(std::memory_order_acquire);
+			ns = slowest_ns_.load(std::memory_order_relaxed);
+			function = slowest_function_.load(std::memory_order_relaxed);
+			file_line = slowest_file_line_.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while ((seq & 1) || seq != slowest_seq_.load(std::memory_order_relaxed));
+		if (where)
+		{
+			*where = (function ? Location(function, file_line) : Location());
+		}
+		return ns;
+	}
+	void EventCenterStats::add_iteration(uint64_t ns)
+	{
+		add(iterations_, 1);
+		int bucket = 0;
+		for (uint64_t us = ns / 1000; us > 0 && bucket < HISTOGRAM_BUCKETS - 1; us >>= 1)
+		{
+			++bucket;
+		}
+		add(histogram_[bucket], 1);
+	}
+	void EventCenterStats::add_callback(const Location& where, uint64_t ns)
+	{
+		add(callbacks_, 1);
+		add(callback_ns_, ns);
+		if (ns > slowest_ns_.load(std::memory_order_relaxed))
+		{
+			uint32_t seq = slowest_seq_.load(std::memory_order_relaxed);
+			slowest_seq_.store(seq + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			slowest_ns_.store(ns, std::memory_order_relaxed);
+			slowest_function_.store(where.function_name(), std::memory_order_relaxed);
+			slowest_file_line_.store(where.file_and_line(), std::memory_order_relaxed);
+			slowest_seq_.store(seq + 2, std::memory_order_release);
+		}
+	}
+
+	/*
+	*	class TimerWheel
+	*/
+
+	TimerWheel::TimerWheel()
+		: now_(0)
+		, count_(0)
+		, free_(NIL)
+	{
+		clear();
+	}
+	uint64_t TimerWheel::add(uint64_t now, uint64_t expire, EventCallbackRef cb)
+	{
+		if (count_ == 0 && now > now_)
+		{
+			now_ = now;
+		}
+		uint32_t i = free_;
+		if (i != NIL)
+		{
+			free_ = nodes_[i].next;
+		}
+		else
+		{
+			i = (uint32_t)nodes_.size();
+			Node n;
+			n.gen = 1;
+			nodes_.push_back(n);
+		}
+		Node& n = nodes_[i];
+		// the slot of the current tick has already fired
+		n.expire = std::max(expire, now_ + 1);
+		n.cb = cb;
+		link(i);
+		++count_;
+		return make_id(i);
+	}
+	bool TimerWheel::cancel(uint64_t id)
+	{
+		uint64_t index = (id & 0xffffffffu);
+		if (index == 0 || index > nodes_.size())
+		{
+			return false;
+		}
+		uint32_t i = (uint32_t)(index - 1);
+		if (nodes_[i].gen != (uint32_t)(id >> 32) || nodes_[i].slot == NIL)
+		{
+			return false;
+		}
+		unlink(i);
+		release(i);
+		return true;
+	}
+	uint64_t TimerWheel::next_expiry() const
+	{
+		if (count_ == 0)
+		{
+			return UINT64_MAX;
+		}
+		uint64_t next = UINT64_MAX;
+		for (int level = 0; level < LEVELS; ++level)
+		{
+			int shift = level * SLOT_BITS;
+			uint64_t base = now_ >> shift;
+			uint32_t cur = (uint32_t)(base & (SLOTS - 1));
+			uint32_t j = next_set(level, cur + 1);
+			if (j == SLOTS)
+			{
+				j = next_set(level, 0);
+				if (j == SLOTS)
+				{
+					continue;
+				}
+			}
+			uint64_t dist = (j - cur) & (SLOTS - 1);
+			if (dist == 0)
+			{
+				dist = SLOTS;
+			}
+			// level 0 is exact, above it this is when the slot is cascaded
+			next = std::min(next, (base + dist) << shift);
+		}
+		return next;
+	}
+	void TimerWheel::clear()
+	{
+		nodes_.clear();
+		free_ = NIL;
+		count_ = 0;
+		for (uint32_t i = 0; i < LEVELS * SLOTS; ++i)
+		{
+			heads_[i] = NIL;
+		}
+		memset(occupied_, 0, sizeof(occupied_));
+	}
+	void TimerWheel::link(uint32_t i)
+	{
+		Node& n = nodes_[i];
+		uint64_t delta = n.expire - now_;
+		uint64_t at = n.expire;
+		if (delta >= ((uint64_t)1 << (LEVELS * SLOT_BITS)))
+		{
+			// beyond the wheel: wait in the last top level slot, its cascade links it again
+			delta = ((uint64_t)1 << (LEVELS * SLOT_BITS)) - 1;
+			at = now_ + delta;
+		}
+		int level = 0;
+		while (delta >= ((uint64_t)1 << ((level + 1) * SLOT_BITS)))
+		{
+			++level;
+		}
+		uint32_t idx = (uint32_t)((at >> (level * SLOT_BITS)) & (SLOTS - 1));
+		uint32_t slot = level * SLOTS + idx;
+		n.slot = slot;
+		n.prev = NIL;
+		n.next = heads_[slot];
+		if (n.next != NIL)
+		{
+			nodes_[n.next].prev = i;
+		}
+		heads_[slot] = i;
+		occupied_[level][idx / 64] |= ((uint64_t)1 << (idx % 64));
+	}
+	void TimerWheel::unlink(uint32_t i)
+	{
+		Node& n = nodes_[i];
+		if (n.prev != NIL)
+		{
+			nodes_[n.prev].next = n.next;
+		}
+		else
+		{
+			heads_[n.slot] = n.next;
+			if (n.next == NIL)
+			{
+				uint32_t level = n.slot / SLOTS;
+				uint32_t idx = n.slot % SLOTS;
+				occupied_[level][idx / 64] &= ~((uint64_t)1 << (idx % 64));
+			}
+		}
+		if (n.next != NIL)
+		{
+			nodes_[n.next].prev = n.prev;
+		}
+		n.slot = NIL;
+	}
+	void TimerWheel::release(uint32_t i)
+	{
+		Node& n = nodes_[i];
+		++n.gen;
+		n.cb = nullptr;
+		n.next = free_;
+		free_ = i;
+		--count_;
+	}
+	void TimerWheel::cascade()
+	{
+		// higher levels first, what they hand down may have to move down again
+		for (int level = LEVELS - 1; level > 0; --level)
+		{
+			int shift = level * SLOT_BITS;
+			if ((now_ & (((uint64_t)1 << shift) - 1)) != 0)
+			{
+				continue;
+			}
+			uint32_t slot = level * SLOTS + (uint32_t)((now_ >> shift) & (SLOTS - 1));
+			while (heads_[slot] != NIL)
+			{
+				uint32_t i = heads_[slot];
+				unlink(i);
+				link(i);
+			}
+		}
+	}
+	uint32_t TimerWheel::next_set(int level, uint32_t from) const
+	{
+		for (uint32_t w = from / 64; w < SLOTS / 64; ++w)
+		{
+			uint64_t bits = occupied_[level][w];
+			if (w == from / 64)
+			{
+				bits &= (~(uint64_t)0) << (from % 64);
+			}
+			if (bits)
+			{
+				return w * 64 + (uint32_t)__builtin_ctzll(bits);
+			}
+		}
+		return SLOTS;
+	}
+
+	/*
+	*	class EventCenter
+	*/
+
 	EventCenter::EventCenter()
-		: time_event_next_id(1)
+		: time_base(clock_type::now())
+		, busy_poll_max(0)
+		, busy_poll_budget(0)
+		, busy_poll_adaptive(true)
+		, external_head(&external_stub)
+		, external_tail(&external_stub)
+		, external_parked(false)
+		, stats_(nullptr)
+		, callback_ns_local(0)
 	{
 	}
 	EventCenter::~EventCenter()
 	{
-
+		delete stats_.load();
 	}
 	int EventCenter::set_owner()
 	{
@@ -23,19 +470,14 @@ namespace tiny
 	void EventCenter::unset_owner()
 	{
 		uninitialize();
+		while (external_head.load() != &external_stub)
 		{
-			std::lock_guard<std::mutex> l(external_lock);
-			while (!external_events.empty())
+			if (process_external_events() == 0)
 			{
-				EventCallbackPtr e(external_events.front());
-				external_events.pop_front();
-				if (e)
-				{
-					e->do_request(0);
-				}
+				std::this_thread::yield();
 			}
-			owner = std::thread::id();
 		}
+		owner = std::thread::id();
 		time_events.clear();
 	}
 	void EventCenter::notify()
@@ -46,34 +488,22 @@ namespace tiny
 	{
 		return (owner == std::this_thread::get_id());
 	}
+	uint64_t EventCenter::to_tick(clock_type::time_point t) const
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(t - time_base).count();
+	}
 	uint64_t EventCenter::create_time_event(uint64_t microseconds, EventCallbackRef ctxt)
 	{
 		tiny_assert(in_thread());
-		uint64_t id = time_event_next_id++;
-		EventCenter::TimeEvent event;
-		clock_type::time_point expire = clock_type::now() + std::chrono::microseconds(microseconds);
-		event.id = id;
-		event.time_cb = ctxt;
-		std::multimap<clock_type::time_point, TimeEvent>::value_type s_val(expire, event);
-		auto it = time_events.insert(std::move(s_val));
-		event_map[id] = it;
-
-		return id;
+		// round up, a timer never fires early
+		clock_type::time_point now = clock_type::now();
+		clock_type::time_point expire = now + std::chrono::microseconds(microseconds + 999);
+		return time_events.add(to_tick(now), to_tick(expire), ctxt);
 	}
 	void EventCenter::delete_time_event(uint64_t id)
 	{
 		tiny_assert(in_thread());
-		if (id >= time_event_next_id || id == 0)
-			return;
-
-		auto it = event_map.find(id);
-		if (it == event_map.end()) 
-		{
-			return;
-		}
-
-		time_events.erase(it->second);
-		event_map.erase(it);
+		time_events.cancel(id);
 	}
 	int EventCenter::process_events(unsigned timeout_microseconds)
 	{
@@ -84,11 +514,11 @@ namespace tiny
 		auto now = clock_type::now();
 		clock_type::time_point shortest;
 		shortest = now + std::chrono::microseconds(timeout_microseconds);
-		auto it = time_events.begin();
-		if (it != time_events.end() && shortest >= it->first) 
+		uint64_t next_tick = time_events.next_expiry();
+		if (next_tick != UINT64_MAX && shortest >= time_base + std::chrono::milliseconds(next_tick))
 		{
 			trigger_time = true;
-			shortest = it->first;
+			shortest = time_base + std::chrono::milliseconds(next_tick);
 			if (shortest > now) {
 				timeout_microseconds = std::chrono::duration_cast<std::chrono::microseconds>(
 					shortest - now).count();
@@ -102,66 +532,410 @@ namespace tiny
 		tv.tv_usec = timeout_microseconds % 1000000;
 
 
-		numevents = event_wait(&tv);
+		EventCenterStats* stats = stats_.load(std::memory_order_relaxed);
+		uint64_t callback_before = callback_ns_local;
+		clock_type::time_point wait_begin = (stats ? clock_type::now() : now);
+		// not parked while spinning, producers skip the wakeup
+		const bool spin = (busy_poll_budget != 0 && timeout_microseconds != 0);
+		if (!spin || !busy_poll(shortest, numevents))
+		{
+			// announce the wait before looking at the queue, a producer that pushes after
+			// this sees the flag and wakes us up
+			if (spin)
+			{
+				// the spin used part of the timeout, only wait for what is left of it
+				auto left = std::chrono::duration_cast<std::chrono::microseconds>(shortest - clock_type::now()).count();
+				left = std::max(left, (decltype(left))0);
+				tv.tv_sec = (long)(left / 1000000);
+				tv.tv_usec = (long)(left % 1000000);
+			}
+			external_parked.store(true);
+			if (external_head.load() != &external_stub)
+			{
+				tv.tv_sec = 0;
+				tv.tv_usec = 0;
+			}
+			numevents = event_wait(&tv);
+			external_parked.store(false, std::memory_order_relaxed);
+		}
+		if (stats)
+		{
+			// file callbacks run inside event_wait
+			uint64_t waited = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - wait_begin).count();
+			EventCenterStats::add(stats->wait_ns_, waited - std::min(waited, callback_ns_local - callback_before));
+		}
 
 		if (trigger_time)
 		{
 			numevents += process_time_events();
 		}
-			
-		if (external_num_events.load()) {
-			external_lock.lock();
-			std::deque<EventCallbackRef> cur_process;
-			cur_process.swap(external_events);
-			external_num_events.store(0);
-			external_lock.unlock();
-			numevents += cur_process.size();
-			while (!cur_process.empty()) 
-			{
-				EventCallbackPtr e(cur_process.front());
-				cur_process.pop_front();
-				e->do_request(0);
-			}
+
+		numevents += process_external_events();
+		if (stats)
+		{
+			stats->add_iteration(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - now).count());
 		}
 		return numevents;
 	}
 	void EventCenter::dispatch_event_external(EventCallbackRef e)
 	{
-		uint64_t num = 0;
+		if (e->external_queued.exchange(true, std::memory_order_acq_rel))
 		{
-			external_lock.lock();
-			if (external_num_events > 0 && *external_events.rbegin() == e) {
-				external_lock.unlock();
-				return;
-			}
-			external_events.push_back(e);
-			num = ++external_num_events;
-			external_lock.unlock();
+			// already waiting to run
+			return;
 		}
-		if (num == 1 && !in_thread())
+		push_external(e);
+		EventCenterStats* stats = stats_.load(std::memory_order_relaxed);
+		if (stats)
+		{
+			stats->external_pushed_.fetch_add(1, std::memory_order_relaxed);
+		}
+		if (external_parked.load() && external_parked.exchange(false) && !in_thread())
+		{
 			notify();
+		}
+	}
+	void EventCenter::push_external(EventCallbackRef e)
+	{
+		e->external_next.store(nullptr, std::memory_order_relaxed);
+		EventCallbackRef prev = external_head.exchange(e);
+		prev->external_next.store(e, std::memory_order_release);
+	}
+	EventCallbackRef EventCenter::pop_external()
+	{
+		EventCallbackRef tail = external_tail;
+		EventCallbackRef next = tail->external_next.load(std::memory_order_acquire);
+		if (tail == &external_stub)
+		{
+			if (!next)
+			{
+				return nullptr;
+			}
+			external_tail = next;
+			tail = next;
+			next = next->external_next.load(std::memory_order_acquire);
+		}
+		if (next)
+		{
+			external_tail = next;
+			return tail;
+		}
+		if (tail != external_head.load())
+		{
+			// a producer is between its exchange and linking the node, take it next time
+			return nullptr;
+		}
+		push_external(&external_stub);
+		next = tail->external_next.load(std::memory_order_acquire);
+		if (next)
+		{
+			external_tail = next;
+			return tail;
+		}
+		return nullptr;
+	}
+	int EventCenter::process_external_events()
+	{
+		int processed = 0;
+		while (processed < MAX_EXTERNAL_BATCH)
+		{
+			EventCallbackRef ref = pop_external();
+			if (!ref)
+			{
+				break;
+			}
+			// cleared first, do_request may dispatch it again
+			ref->external_queued.store(false, std::memory_order_release);
+			EventCallbackPtr e(ref);
+			run_callback(ref, 0);
+			++processed;
+		}
+		EventCenterStats* stats = stats_.load(std::memory_order_relaxed);
+		if (stats && processed > 0)
+		{
+			EventCenterStats::add(stats->external_processed_, processed);
+		}
+		return processed;
+	}
+	void EventCenter::set_busy_poll(unsigned budget_microseconds, bool adaptive)
+	{
+		busy_poll_max = budget_microseconds;
+		busy_poll_budget = budget_microseconds;
+		busy_poll_adaptive = adaptive;
+	}
+	bool EventCenter::busy_poll(clock_type::time_point deadline, int& numevents)
+	{
+		auto now = clock_type::now();
+		auto until = std::min(deadline, now + std::chrono::microseconds(busy_poll_budget));
+		struct timeval zero = { 0, 0 };
+		unsigned relax = 1;
+		bool found = false;
+		while (!found && now < until)
+		{
+			int n = event_wait(&zero);
+			if (n > 0)
+			{
+				numevents += n;
+			}
+			found = (n > 0 || external_head.load() != &external_stub);
+			if (!found)
+			{
+				// back off between polls, each one is a syscall
+				for (unsigned i = 0; i < relax; ++i)
+				{
+					cpu_relax();
+				}
+				relax = std::min(relax << 1, 64u);
+				now = clock_type::now();
+			}
+		}
+		if (busy_poll_adaptive)
+		{
+			if (found)
+			{
+				busy_poll_budget = std::min(busy_poll_budget << 1, busy_poll_max);
+			}
+			else if (until != deadline)
+			{
+				busy_poll_budget = std::max(busy_poll_budget >> 1, std::max(busy_poll_max >> 4, 1u));
+			}
+		}
+		// ran into the next timer, it is due now and there's nothing to park for
+		return (found || now >= deadline);
 	}
 	int EventCenter::process_time_events()
 	{
 		tiny_assert(in_thread());
-		int processed = 0;
-		clock_type::time_point now = clock_type::now();
+		int fired = time_events.advance(to_tick(clock_type::now()), [this](uint64_t id, EventCallbackRef time_cb) {
+			EventCallbackPtr cb(time_cb);
+			run_callback(time_cb, id);
+		});
+		EventCenterStats* stats = stats_.load(std::memory_order_relaxed);
+		if (stats && fired > 0)
+		{
+			EventCenterStats::add(stats->time_events_fired_, fired);
+		}
+		return fired;
+	}
+	void EventCenter::enable_stats()
+	{
+		if (!stats_.load())
+		{
+			stats_.store(new EventCenterStats, std::memory_order_release);
+		}
+	}
+	void EventCenter::run_timed(EventCenterStats* stats, EventCallbackRef cb, uint64_t id)
+	{
+		// taken before the call, cb may be gone after it
+		Location where = cb->location();
+		uint64_t begin = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count();
+		stats->running_since_.store(begin, std::memory_order_relaxed);
+		cb->do_request(id);
+		uint64_t end = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count();
+		stats->running_since_.store(0, std::memory_order_relaxed);
+		callback_ns_local += end - begin;
+		stats->add_callback(where, end - begin);
+	}
+
+#ifndef UNI_WIN
+	/*
+	*	class FileEventCenter
+	*/
+
+	class FileEventCenter::C_drain_notify : public EventCallback
+	{
+	public:
+		void do_request(uint64_t fd) override
+		{
+			eventfd_t value;
+			while (eventfd_read((int)fd, &value) == 0)
+			{
+			}
+		}
+	};
 
-		while (!time_events.empty()) {
-			auto it = time_events.begin();
-			if (now >= it->first) {
-				TimeEvent& e = it->second;
-				EventCallbackPtr cb(e.time_cb);
-				uint64_t id = e.id;
-				time_events.erase(it);
-				event_map.erase(id);
-				processed++;
-				cb->do_request(id);
+	FileEventCenter::FileEventCenter(int nevent, bool use_uring)
+		: nevent_(nevent)
+		, use_uring_(use_uring)
+		, notify_fd_(-1)
+	{
+	}
+	FileEventCenter::~FileEventCenter()
+	{
+		int fd = notify_fd_.exchange(-1);
+		if (fd >= 0)
+		{
+			::close(fd);
+		}
+	}
+	int FileEventCenter::initialize()
+	{
+		int r = 0;
+		if (use_uring_)
+		{
+			driver_.reset(new UringDriver);
+			r = driver_->init(this, nevent_);
+			if (r < 0)
+			{
+				std::cout << "io_uring unavailable, falling back to epoll: " << cpp_strerror(-r) << std::endl;
+				driver_.reset();
 			}
-			else {
-				break;
+		}
+		if (!driver_)
+		{
+			driver_.reset(new EpollDriver);
+			r = driver_->init(this, nevent_);
+			if (r < 0)
+			{
+				driver_.reset();
+				return r;
 			}
 		}
-		return processed;
+		file_events_.resize(nevent_);
+		// created once and closed only by the destructor: a wakeup racing uninitialize
+		// may still write to it, and must never reach an fd that reused its number
+		int fd = notify_fd_.load();
+		if (fd < 0)
+		{
+			fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (fd < 0)
+			{
+				int err = errno;
+				std::cout << "eventfd failed: " << cpp_strerror(err) << std::endl;
+				return -err;
+			}
+			notify_fd_.store(fd);
+			notify_cb_.reset(new C_drain_notify);
+		}
+		return create_file_event(fd, EVENT_READABLE, notify_cb_.get());
+	}
+	void FileEventCenter::uninitialize()
+	{
+		int fd = notify_fd_.load();
+		if (fd >= 0 && driver_)
+		{
+			delete_file_event(fd, EVENT_READABLE);
+		}
+		file_events_.clear();
+		driver_.reset();
+	}
+	void FileEventCenter::wakeup()
+	{
+		int fd = notify_fd_.load();
+		if (fd >= 0)
+		{
+			eventfd_write(fd, 1);
+		}
+	}
+	int FileEventCenter::create_file_event(int fd, int mask, EventCallbackRef ctxt)
+	{
+		tiny_assert(in_thread());
+		tiny_assert(driver_);
+		if (fd < 0)
+		{
+			return -EINVAL;
+		}
+		if ((size_t)fd >= file_events_.size())
+		{
+			int new_size = std::max(nevent_, 1);
+			while (new_size <= fd)
+			{
+				new_size <<= 1;
+			}
+			int r = driver_->resize_events(new_size);
+			if (r < 0)
+			{
+				return r;
+			}
+			nevent_ = new_size;
+			file_events_.resize(new_size);
+		}
+		FileEvent* event = &file_events_[fd];
+		int add_mask = mask & ~event->mask;
+		if (add_mask)
+		{
+			int r = driver_->add_event(fd, event->mask, add_mask);
+			if (r < 0)
+			{
+				return r;
+			}
+			event->mask |= add_mask;
+		}
+		if (mask & EVENT_READABLE)
+		{
+			event->read_cb = ctxt;
+		}
+		if (mask & EVENT_WRITABLE)
+		{
+			event->write_cb = ctxt;
+		}
+		return 0;
+	}
+	void FileEventCenter::delete_file_event(int fd, int mask)
+	{
+		tiny_assert(in_thread());
+		if (fd < 0 || (size_t)fd >= file_events_.size())
+		{
+			return;
+		}
+		FileEvent* event = &file_events_[fd];
+		// a dropped fd has no mask left but may still have its callbacks
+		if (event->mask)
+		{
+			// once neither direction is left the fd goes away, edge mode with it
+			if (!(event->mask & ~mask & (EVENT_READABLE | EVENT_WRITABLE)))
+			{
+				mask |= EVENT_EDGE;
+			}
+			driver_->del_event(fd, event->mask, mask);
+		}
+		if (mask & EVENT_READABLE)
+		{
+			event->read_cb = nullptr;
+		}
+		if (mask & EVENT_WRITABLE)
+		{
+			event->write_cb = nullptr;
+		}
+		event->mask = event->mask & (~mask);
+	}
+	int FileEventCenter::event_wait(struct timeval* tv)
+	{
+		int numevents = driver_->event_wait(fired_events_, tv);
+		if (numevents <= 0)
+		{
+			return 0;
+		}
+		for (int i = 0; i < numevents; ++i)
+		{
+			int fd = fired_events_[i].fd;
+			int fired = fired_events_[i].mask & file_events_[fd].mask;
+			const bool dropped = ((fired_events_[i].mask & EVENT_DROPPED) != 0);
+			if (dropped)
+			{
+				// the driver stopped polling the fd, forget it here too so that registering
+				// it again arms it; the callbacks still get this last event
+				file_events_[fd].mask = EVENT_NONE;
+			}
+			bool rfired = false;
+			// a callback may delete the events of any fd, look them up again each time
+			if (fired & EVENT_READABLE)
+			{
+				rfired = true;
+				EventCallbackRef cb = file_events_[fd].read_cb;
+				run_callback(cb, fd);
+			}
+			if ((fired & EVENT_WRITABLE)
+				&& (dropped ? (file_events_[fd].write_cb != nullptr) : ((file_events_[fd].mask & EVENT_WRITABLE) != 0)))
+			{
+				EventCallbackRef cb = file_events_[fd].write_cb;
+				if (!rfired || file_events_[fd].read_cb != cb)
+				{
+					run_callback(cb, fd);
+				}
+			}
+		}
+		return numevents;
 	}
+#endif // !UNI_WIN
 }
@@ -0,0 +1,148 @@
+#include "tiny_event_epoll.h"
+
+#ifndef UNI_WIN
+#include <unistd.h>
+#include <string.h>
+
+namespace tiny
+{
+	EpollDriver::EpollDriver()
+		: epfd_(-1)
+		, size_(0)
+		, events_(nullptr)
+	{
+	}
+	EpollDriver::~EpollDriver()
+	{
+		if (epfd_ >= 0)
+		{
+			::close(epfd_);
+		}
+		free(events_);
+	}
+	int EpollDriver::init(EventCenter* center, int nevent)
+	{
+		events_ = (struct epoll_event*)calloc(nevent, sizeof(struct epoll_event));
+		if (!events_)
+		{
+			return -ENOMEM;
+		}
+		epfd_ = epoll_create1(EPOLL_CLOEXEC);
+		if (epfd_ < 0)
+		{
+			int err = errno;
+			std::cout << "epoll_create1 failed: " << cpp_strerror(err) << std::endl;
+			return -err;
+		}
+		size_ = nevent;
+		return 0;
+	}
+	uint32_t EpollDriver::to_epoll(int mask)
+	{
+		uint32_t events = 0;
+		if (mask & EVENT_READABLE)
+		{
+			events |= EPOLLIN | EPOLLRDHUP;
+		}
+		if (mask & EVENT_WRITABLE)
+		{
+			events |= EPOLLOUT;
+		}
+		if (mask & EVENT_EDGE)
+		{
+			events |= EPOLLET;
+		}
+		return events;
+	}
+	int EpollDriver::add_event(int fd, int cur_mask, int add_mask)
+	{
+		// an already registered fd only changes its mask
+		int op = ((cur_mask & (EVENT_READABLE | EVENT_WRITABLE)) == EVENT_NONE) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+		struct epoll_event ee;
+		memset(&ee, 0, sizeof(ee));
+		ee.events = to_epoll(cur_mask | add_mask);
+		ee.data.fd = fd;
+		if (epoll_ctl(epfd_, op, fd, &ee) == -1)
+		{
+			int err = errno;
+			std::cout << "epoll_ctl " << (op == EPOLL_CTL_ADD ? "add" : "mod") << " fd " << fd << " failed: " << cpp_strerror(err) << std::endl;
+			return -err;
+		}
+		return 0;
+	}
+	int EpollDriver::del_event(int fd, int cur_mask, int del_mask)
+	{
+		struct epoll_event ee;
+		memset(&ee, 0, sizeof(ee));
+		int mask = cur_mask & (~del_mask);
+		if ((mask & (EVENT_READABLE | EVENT_WRITABLE)) != EVENT_NONE)
+		{
+			ee.events = to_epoll(mask);
+			ee.data.fd = fd;
+			if (epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ee) < 0)
+			{
+				int err = errno;
+				std::cout << "epoll_ctl mod fd " << fd << " failed: " << cpp_strerror(err) << std::endl;
+				return -err;
+			}
+		}
+		else
+		{
+			// the fd may already be closed, which removed it from the set
+			if (epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, &ee) < 0 && errno != EBADF && errno != ENOENT)
+			{
+				int err = errno;
+				std::cout << "epoll_ctl del fd " << fd << " failed: " << cpp_strerror(err) << std::endl;
+				return -err;
+			}
+		}
+		return 0;
+	}
+	int EpollDriver::event_wait(std::vector<FiredFileEvent>& fired_events, struct timeval* tvp)
+	{
+		int timeout = -1;
+		if (tvp)
+		{
+			// round up, a timer due in 300us must not spin with timeout 0
+			timeout = (int)(tvp->tv_sec * 1000 + (tvp->tv_usec + 999) / 1000);
+		}
+		int retval = epoll_wait(epfd_, events_, size_, timeout);
+		if (retval <= 0)
+		{
+			return ((retval < 0 && errno != EINTR) ? -errno : 0);
+		}
+		fired_events.resize(retval);
+		for (int j = 0; j < retval; ++j)
+		{
+			int mask = 0;
+			struct epoll_event* e = events_ + j;
+			if (e->events & (EPOLLIN | EPOLLRDHUP))
+			{
+				mask |= EVENT_READABLE;
+			}
+			if (e->events & EPOLLOUT)
+			{
+				mask |= EVENT_WRITABLE;
+			}
+			if (e->events & (EPOLLERR | EPOLLHUP))
+			{
+				mask |= EVENT_READABLE | EVENT_WRITABLE;
+			}
+			fired_events[j].fd = e->data.fd;
+			fired_events[j].mask = mask;
+		}
+		return retval;
+	}
+	int EpollDriver::resize_events(int newsize)
+	{
+		struct epoll_event* events = (struct epoll_event*)realloc(events_, sizeof(struct epoll_event) * newsize);
+		if (!events)
+		{
+			return -ENOMEM;
+		}
+		events_ = events;
+		size_ = newsize;
+		return 0;
+	}
+}
+#endif // !UNI_WIN
@@ -0,0 +1,105 @@
+#include "tiny_event_pool.h"
+
+#ifndef UNI_WIN
+#include <sched.h>
+#include <stdlib.h>
+
+namespace tiny
+{
+
+	EventCenterPool::EventCenterPool(size_t loops, bool pin_cpu, unsigned timeout_microseconds, bool use_uring)
+		: nloops_(loops)
+		, pin_cpu_(pin_cpu)
+		, use_uring_(use_uring)
+		, timeout_(timeout_microseconds)
+		, next_(0)
+	{
+		if (nloops_ == 0)
+		{
+			nloops_ = std::max(1u, std::thread::hardware_concurrency());
+		}
+	}
+	EventCenterPool::~EventCenterPool()
+	{
+		Destroy();
+	}
+	size_t EventCenterPool::loop_for(uint64_t key) const
+	{
+		// fds and ports come in runs, mix them before taking the modulo
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		return (size_t)(key % loops_.size());
+	}
+	int EventCenterPool::OnCreate(size_t& thread_nums)
+	{
+		loops_.clear();
+		for (size_t i = 0; i < nloops_; ++i)
+		{
+			loops_.push_back(std::unique_ptr<Loop>(new Loop(use_uring_)));
+		}
+		thread_nums = nloops_;
+		return 0;
+	}
+	ThreadPlacement EventCenterPool::thread_placement() const
+	{
+		// filled in on a copy, placement keeps what the caller set
+		ThreadPlacement where = placement;
+		if (where.name.empty())
+		{
+			where.name = "evloop";
+		}
+		// a placement set by the caller wins; otherwise the CPUs the process may run
+		// on, which under taskset or a cpuset need not be 0..n-1
+		if (pin_cpu_ && where.cpus.empty())
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			if (sched_getaffinity(0, sizeof(set), &set) == 0)
+			{
+				for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+				{
+					if (CPU_ISSET(cpu, &set))
+					{
+						where.cpus.push_back(cpu);
+					}
+				}
+			}
+			where.cpu_per_thread = !where.cpus.empty();
+		}
+		return where;
+	}
+	void EventCenterPool::OnDestroyed()
+	{
+		loops_.clear();
+	}
+	std::function<void()> EventCenterPool::add_thread(unsigned int thread_index)
+	{
+		Loop* w = loops_[thread_index].get();
+		return [this, w, thread_index]() {
+			int r = w->center.set_owner();
+			w->init_done();
+			if (r < 0)
+			{
+				std::cout << "event loop " << thread_index << " initialize failed: " << cpp_strerror(r) << std::endl;
+				return;
+			}
+			while (!w->is_done())
+			{
+				w->center.process_events(timeout_);
+			}
+			w->center.unset_owner();
+		};
+	}
+	void EventCenterPool::remove_thread(unsigned int index)
+	{
+		// set on the loop itself, done is a plain bool
+		Loop* w = loops_[index].get();
+		w->center.submit_to([w]() { w->set_done(); }, true);
+	}
+	void EventCenterPool::wait_started(unsigned int index)
+	{
+		loops_[index]->wait_for_init();
+	}
+}
+#endif // !UNI_WIN
@@ -0,0 +1,393 @@
+#include "tiny_event_uring.h"
+
+#ifndef UNI_WIN
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define TINY_HAVE_IO_URING 1
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#endif
+#endif
+
+namespace tiny
+{
+	// user_data is gen << 32 | fd; removes carry the tag and complete unnoticed
+	static const uint64_t URING_REMOVE_TAG = 1ULL << 63;
+	static const uint32_t URING_GEN_MASK = 0x7fffffffu;
+
+	UringDriver::UringDriver()
+		: ring_fd_(-1)
+		, size_(0)
+		, pending_(0)
+		, sq_ptr_(nullptr)
+		, sq_len_(0)
+		, sq_head_(nullptr)
+		, sq_tail_(nullptr)
+		, sq_mask_(0)
+		, sq_entries_(0)
+		, sqes_(nullptr)
+		, sqes_len_(0)
+		, cq_ptr_(nullptr)
+		, cq_len_(0)
+		, cq_head_(nullptr)
+		, cq_tail_(nullptr)
+		, cq_mask_(0)
+		, cqes_(nullptr)
+	{
+	}
+#ifdef TINY_HAVE_IO_URING
+	UringDriver::~UringDriver()
+	{
+		if (sqes_)
+		{
+			munmap(sqes_, sqes_len_);
+		}
+		if (cq_ptr_ && cq_ptr_ != sq_ptr_)
+		{
+			munmap(cq_ptr_, cq_len_);
+		}
+		if (sq_ptr_)
+		{
+			munmap(sq_ptr_, sq_len_);
+		}
+		if (ring_fd_ >= 0)
+		{
+			::close(ring_fd_);
+		}
+	}
+	int UringDriver::init(EventCenter* center, int nevent)
+	{
+		unsigned entries = 64;
+		while (entries < (unsigned)nevent && entries < 4096)
+		{
+			entries <<= 1;
+		}
+		struct io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		ring_fd_ = (int)syscall(__NR_io_uring_setup, entries, &p);
+		if (ring_fd_ < 0)
+		{
+			int err = errno;
+			std::cout << "io_uring_setup failed: " << cpp_strerror(err) << std::endl;
+			return -err;
+		}
+		// the timeout rides on io_uring_enter and a full completion ring must not lose polls
+		if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP))
+		{
+			std::cout << "io_uring lacks EXT_ARG/NODROP, features " << p.features << std::endl;
+			return -ENOSYS;
+		}
+		sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+		bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single)
+		{
+			sq_len_ = cq_len_ = std::max(sq_len_, cq_len_);
+		}
+		sq_ptr_ = mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+		if (sq_ptr_ == MAP_FAILED)
+		{
+			sq_ptr_ = nullptr;
+			return -errno;
+		}
+		if (single)
+		{
+			cq_ptr_ = sq_ptr_;
+		}
+		else
+		{
+			cq_ptr_ = mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+			if (cq_ptr_ == MAP_FAILED)
+			{
+				cq_ptr_ = nullptr;
+				return -errno;
+			}
+		}
+		sqes_len_ = p.sq_entries * sizeof(struct io_uring_sqe);
+		void* sqes = mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+		{
+			return -errno;
+		}
+		sqes_ = (struct io_uring_sqe*)sqes;
+
+		char* sq = (char*)sq_ptr_;
+		sq_head_ = (unsigned*)(sq + p.sq_off.head);
+		sq_tail_ = (unsigned*)(sq + p.sq_off.tail);
+		sq_mask_ = *(unsigned*)(sq + p.sq_off.ring_mask);
+		sq_entries_ = p.sq_entries;
+		// sqe i always sits in array slot i
+		unsigned* array = (unsigned*)(sq + p.sq_off.array);
+		for (unsigned i = 0; i < sq_entries_; ++i)
+		{
+			array[i] = i;
+		}
+		char* cq = (char*)cq_ptr_;
+		cq_head_ = (unsigned*)(cq + p.cq_off.head);
+		cq_tail_ = (unsigned*)(cq + p.cq_off.tail);
+		cq_mask_ = *(unsigned*)(cq + p.cq_off.ring_mask);
+		cqes_ = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+		size_ = nevent;
+		return 0;
+	}
+	unsigned UringDriver::sq_space()
+	{
+		unsigned used = *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+		if (used >= sq_entries_)
+		{
+			// ring full, hand the batch over without waiting
+			int r = (int)syscall(__NR_io_uring_enter, ring_fd_, pending_, 0, 0, nullptr, 0);
+			if (r > 0)
+			{
+				pending_ -= std::min(pending_, (unsigned)r);
+			}
+			used = *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+		}
+		return (used >= sq_entries_ ? 0 : sq_entries_ - used);
+	}
+	struct io_uring_sqe* UringDriver::get_sqe()
+	{
+		if (!sq_space())
+		{
+			return nullptr;
+		}
+		struct io_uring_sqe* sqe = &sqes_[*sq_tail_ & sq_mask_];
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+	int UringDriver::poll_add(int fd)
+	{
+		struct io_uring_sqe* sqe = get_sqe();
+		if (!sqe)
+		{
+			return -EBUSY;
+		}
+		uint32_t events = 0;
+		if (masks_[fd] & EVENT_READABLE)
+		{
+			events |= POLLIN | POLLRDHUP;
+		}
+		if (masks_[fd] & EVENT_WRITABLE)
+		{
+			events |= POLLOUT;
+		}
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		sqe->poll32_events = events;
+		sqe->user_data = ((uint64_t)gens_[fd] << 32) | (uint32_t)fd;
+		__atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+		++pending_;
+		return 0;
+	}
+	int UringDriver::poll_remove(int fd)
+	{
+		struct io_uring_sqe* sqe = get_sqe();
+		if (!sqe)
+		{
+			return -EBUSY;
+		}
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = ((uint64_t)gens_[fd] << 32) | (uint32_t)fd;
+		sqe->user_data = URING_REMOVE_TAG;
+		__atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+		++pending_;
+		gens_[fd] = (gens_[fd] + 1) & URING_GEN_MASK;
+		return 0;
+	}
+	int UringDriver::rearm(int fd, int mask)
+	{
+		if ((size_t)fd >= masks_.size())
+		{
+			masks_.resize(fd + 1, 0);
+			gens_.resize(fd + 1, 0);
+		}
+		mask &= (EVENT_READABLE | EVENT_WRITABLE);
+		// fail before touching anything, so the old poll stays armed as the center still believes
+		unsigned space = sq_space();
+		if (mask && !space)
+		{
+			return -EBUSY;
+		}
+		if (masks_[fd])
+		{
+			if (space > (mask ? 1u : 0u))
+			{
+				poll_remove(fd);
+			}
+			else
+			{
+				// no sqe to spare for the cancel, orphan the old poll: its completion is stale now
+				gens_[fd] = (gens_[fd] + 1) & URING_GEN_MASK;
+			}
+		}
+		masks_[fd] = mask;
+		return (mask ? poll_add(fd) : 0);
+	}
+	int UringDriver::add_event(int fd, int cur_mask, int add_mask)
+	{
+		int r = rearm(fd, cur_mask | add_mask);
+		if (r < 0)
+		{
+			std::cout << "io_uring poll add fd " << fd << " failed: " << cpp_strerror(-r) << std::endl;
+		}
+		return r;
+	}
+	int UringDriver::del_event(int fd, int cur_mask, int del_mask)
+	{
+		int r = rearm(fd, cur_mask & (~del_mask));
+		if (r < 0)
+		{
+			std::cout << "io_uring poll remove fd " << fd << " failed: " << cpp_strerror(-r) << std::endl;
+		}
+		return r;
+	}
+	int UringDriver::enter(unsigned wait_nr, struct timeval* tvp)
+	{
+		struct __kernel_timespec ts;
+		struct io_uring_getevents_arg arg;
+		memset(&arg, 0, sizeof(arg));
+		if (tvp)
+		{
+			ts.tv_sec = tvp->tv_sec;
+			ts.tv_nsec = (long long)tvp->tv_usec * 1000;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+			if (tvp->tv_sec == 0 && tvp->tv_usec == 0)
+			{
+				wait_nr = 0;
+			}
+		}
+		int r = (int)syscall(__NR_io_uring_enter, ring_fd_, pending_, wait_nr,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		if (r < 0)
+		{
+			int err = errno;
+			return ((err == ETIME || err == EINTR || err == EBUSY) ? 0 : -err);
+		}
+		pending_ -= std::min(pending_, (unsigned)r);
+		return 0;
+	}
+	int UringDriver::event_wait(std::vector<FiredFileEvent>& fired_events, struct timeval* tvp)
+	{
+		unsigned head = *cq_head_;
+		unsigned wait_nr = (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) ? 1 : 0;
+		int r = enter(wait_nr, tvp);
+		if (r < 0)
+		{
+			return r;
+		}
+		fired_events.clear();
+		unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+		for (; head != tail && (int)fired_events.size() < size_; ++head)
+		{
+			const struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+			uint64_t data = cqe->user_data;
+			if (data & URING_REMOVE_TAG)
+			{
+				continue;
+			}
+			int fd = (int)(uint32_t)data;
+			if ((size_t)fd >= masks_.size() || !masks_[fd] || gens_[fd] != (uint32_t)(data >> 32))
+			{
+				continue;
+			}
+			int mask = 0;
+			if (cqe->res < 0)
+			{
+				// the fd is gone, report it once and stop polling; the center forgets
+				// its mask too, so a later create_file_event arms it again
+				mask = EVENT_READABLE | EVENT_WRITABLE | EVENT_DROPPED;
+				masks_[fd] = 0;
+			}
+			else
+			{
+				if (cqe->res & (POLLIN | POLLRDHUP))
+				{
+					mask |= EVENT_READABLE;
+				}
+				if (cqe->res & POLLOUT)
+				{
+					mask |= EVENT_WRITABLE;
+				}
+				if (cqe->res & (POLLERR | POLLHUP | POLLNVAL))
+				{
+					mask |= EVENT_READABLE | EVENT_WRITABLE;
+				}
+			}
+			// one shot, armed again before the callbacks run and submitted with the next wait;
+			// if the ring stays full the fd is not polled anymore, report it dropped as above
+			if (masks_[fd] && poll_add(fd) < 0)
+			{
+				mask |= EVENT_READABLE | EVENT_WRITABLE | EVENT_DROPPED;
+				masks_[fd] = 0;
+			}
+			FiredFileEvent fe;
+			fe.fd = fd;
+			fe.mask = mask;
+			fired_events.push_back(fe);
+		}
+		__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+		return (int)fired_events.size();
+	}
+#else
+	UringDriver::~UringDriver()
+	{
+	}
+	int UringDriver::init(EventCenter* center, int nevent)
+	{
+		return -ENOSYS;
+	}
+	unsigned UringDriver::sq_space()
+	{
+		return 0;
+	}
+	struct io_uring_sqe* UringDriver::get_sqe()
+	{
+		return nullptr;
+	}
+	int UringDriver::enter(unsigned wait_nr, struct timeval* tvp)
+	{
+		return -ENOSYS;
+	}
+	int UringDriver::poll_add(int fd)
+	{
+		return -ENOSYS;
+	}
+	int UringDriver::poll_remove(int fd)
+	{
+		return -ENOSYS;
+	}
+	int UringDriver::rearm(int fd, int mask)
+	{
+		return -ENOSYS;
+	}
+	int UringDriver::add_event(int fd, int cur_mask, int add_mask)
+	{
+		return -ENOSYS;
+	}
+	int UringDriver::del_event(int fd, int cur_mask, int del_mask)
+	{
+		return -ENOSYS;
+	}
+	int UringDriver::event_wait(std::vector<FiredFileEvent>& fired_events, struct timeval* tvp)
+	{
+		return -ENOSYS;
+	}
+#endif // TINY_HAVE_IO_URING
+	int UringDriver::resize_events(int newsize)
+	{
+		size_ = newsize;
+		return 0;
+	}
+}
+#endif // !UNI_WIN
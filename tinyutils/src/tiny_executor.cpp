@@ -0,0 +1,279 @@
+#include "tiny_executor.h"
+
+namespace tiny
+{
+	struct Executor::Worker : public ThreadStack::Worker
+	{
+		Worker(Executor* e, size_t i) : owner(e), index(i), seed((uint32_t)i * 2654435761u + 1) {}
+		uint32_t next_random()
+		{
+			// xorshift, a victim to steal from
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			return seed;
+		}
+		Executor* owner;
+		size_t index;
+		uint32_t seed;
+		WorkDeque<Task> tasks;
+	};
+
+	struct Executor::ForState
+	{
+		ForState(size_t count, size_t g, const std::function<void(size_t, size_t)>& f)
+			: remaining(count), grain(g), body(f), failed(false) {}
+		std::atomic<size_t> remaining;
+		size_t grain;
+		const std::function<void(size_t, size_t)>& body;
+		std::atomic_bool failed;
+		std::exception_ptr error;
+	};
+
+	class Executor::RangeTask : public Executor::Task
+	{
+	public:
+		RangeTask(Executor* e, ForState* s, size_t b, size_t end) : executor_(e), state_(s), begin_(b), end_(end) {}
+		void run() override { executor_->run_range(state_, begin_, end_); }
+	private:
+		Executor* executor_;
+		ForState* state_;
+		size_t begin_;
+		size_t end_;
+	};
+
+	thread_local Executor::Worker* Executor::current_worker = nullptr;
+
+	Executor::Executor(size_t threads)
+		: nthreads_(threads)
+		, injected_(0)
+		, sleepers_(0)
+		, stop_(false)
+	{
+		if (nthreads_ == 0)
+		{
+			nthreads_ = std::max(1u, std::thread::hardware_concurrency());
+		}
+	}
+	Executor::~Executor()
+	{
+		Destroy();
+		for (Task* t : inject_)
+		{
+			delete t;
+		}
+	}
+	int Executor::OnCreate(size_t& thread_nums)
+	{
+		// only reached when not started, running workers are never rebuilt here
+		stop_.store(false);
+		workers_.clear();
+		for (size_t i = 0; i < nthreads_; ++i)
+		{
+			workers_.push_back(std::unique_ptr<Worker>(new Worker(this, i)));
+		}
+		thread_nums = nthreads_;
+		return 0;
+	}
+	ThreadPlacement Executor::thread_placement() const
+	{
+		ThreadPlacement where = placement;
+		if (where.name.empty())
+		{
+			where.name = "executor";
+		}
+		return where;
+	}
+	void Executor::OnDestroyed()
+	{
+		workers_.clear();
+	}
+	std::function<void()> Executor::add_thread(unsigned int thread_index)
+	{
+		Worker* w = workers_[thread_index].get();
+		return [this, w]() {
+			current_worker = w;
+			w->init_done();
+			work(w);
+			current_worker = nullptr;
+		};
+	}
+	void Executor::remove_thread(unsigned int index)
+	{
+		std::lock_guard<std::mutex> l(sleep_lock_);
+		stop_.store(true);
+		sleep_cond_.notify_all();
+	}
+	void Executor::wait_started(unsigned int index)
+	{
+		workers_[index]->wait_for_init();
+	}
+	void Executor::schedule(Task* task)
+	{
+		Worker* w = current_worker;
+		if (w && w->owner == this)
+		{
+			w->tasks.push(task);
+		}
+		else
+		{
+			std::lock_guard<std::mutex> l(inject_lock_);
+			inject_.push_back(task);
+			injected_.fetch_add(1);
+		}
+		wake_one();
+	}
+	void Executor::wake_one()
+	{
+		// pairs with the sleeper's increment before its last look for work
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleepers_.load() > 0)
+		{
+			std::lock_guard<std::mutex> l(sleep_lock_);
+			sleep_cond_.notify_one();
+		}
+	}
+	bool Executor::has_work() const
+	{
+		if (injected_.load() > 0)
+		{
+			return true;
+		}
+		for (const std::unique_ptr<Worker>& w : workers_)
+		{
+			if (!w->tasks.empty())
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	Executor::Task* Executor::find_task(Worker* self)
+	{
+		Task* t = (self ? self->tasks.pop() : nullptr);
+		if (t)
+		{
+			return t;
+		}
+		if (injected_.load(std::memory_order_relaxed) > 0)
+		{
+			std::lock_guard<std::mutex> l(inject_lock_);
+			if (!inject_.empty())
+			{
+				t = inject_.front();
+				inject_.pop_front();
+				injected_.fetch_sub(1);
+				return t;
+			}
+		}
+		size_t n = workers_.size();
+		if (n == 0)
+		{
+			// not started, or stopped: nobody to steal from
+			return nullptr;
+		}
+		size_t start = (self ? self->next_random() : (size_t)std::hash<std::thread::id>()(std::this_thread::get_id())) % n;
+		for (size_t i = 0; i < n; ++i)
+		{
+			Worker* victim = workers_[(start + i) % n].get();
+			if (victim != self && (t = victim->tasks.steal()) != nullptr)
+			{
+				return t;
+			}
+		}
+		return nullptr;
+	}
+	void Executor::work(Worker* w)
+	{
+		for (;;)
+		{
+			Task* t = find_task(w);
+			for (int spin = 0; !t && spin < 64; ++spin)
+			{
+				std::this_thread::yield();
+				t = find_task(w);
+			}
+			if (t)
+			{
+				t->run();
+				delete t;
+				continue;
+			}
+			unique_lock l(sleep_lock_);
+			sleepers_.fetch_add(1);
+			if (has_work())
+			{
+				sleepers_.fetch_sub(1);
+				continue;
+			}
+			if (stop_.load())
+			{
+				sleepers_.fetch_sub(1);
+				return;
+			}
+			sleep_cond_.wait(l);
+			sleepers_.fetch_sub(1);
+		}
+	}
+	void Executor::run_range(ForState* state, size_t begin, size_t end)
+	{
+		// hand the upper halves out, keep the lowest part
+		while (end - begin > state->grain)
+		{
+			size_t mid = begin + (end - begin) / 2;
+			schedule(new RangeTask(this, state, mid, end));
+			end = mid;
+		}
+		if (!state->failed.load(std::memory_order_relaxed))
+		{
+			try
+			{
+				state->body(begin, end);
+			}
+			catch (...)
+			{
+				if (!state->failed.exchange(true))
+				{
+					state->error = std::current_exception();
+				}
+			}
+		}
+		state->remaining.fetch_sub(end - begin, std::memory_order_acq_rel);
+	}
+	void Executor::run_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body)
+	{
+		if (begin >= end)
+		{
+			return;
+		}
+		if (grain == 0)
+		{
+			grain = std::max<size_t>(1, (end - begin) / (nthreads_ * 8));
+		}
+		ForState state(end - begin, grain, body);
+		run_range(&state, begin, end);
+		// help instead of blocking, a worker waiting here must not starve the pool
+		Worker* w = current_worker;
+		if (w && w->owner != this)
+		{
+			w = nullptr;
+		}
+		while (state.remaining.load(std::memory_order_acquire) != 0)
+		{
+			Task* t = find_task(w);
+			if (t)
+			{
+				t->run();
+				delete t;
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+		if (state.error)
+		{
+			std::rethrow_exception(state.error);
+		}
+	}
+}
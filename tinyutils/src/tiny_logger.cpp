@@ -2,10 +2,22 @@
 
 #include "tiny_assert.h"
 #include "tiny_file.h"
+#include "tiny_parser.h"
+#include <algorithm>
+#include <climits>
+#include <fcntl.h>
 #ifndef UNI_WIN
 #include <unistd.h>
 #include <sys/types.h> 
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <signal.h>
+extern char** environ;
+#else
+#include <io.h>
 #endif // !UNI_WIN
 
 namespace tiny
@@ -23,76 +35,112 @@ namespace tiny
 			Item()
 				: level(5)
 				, gather(5)
+				, threshold(5)
 				, name("None")
 			{
 
 			}
-			Item(int i, int g, const std::string& n)
+			Item(int i, int g, int r, const std::string& n)
 				: level(i)
 				, gather(g)
+				, threshold(std::max(std::max(i, g), r))
 				, name(n) {}
-			Item(const Item& i)
-			{
-				level = i.level;
-				gather = i.gather;
-				name = i.name;
-			}
-			Item(Item&& i) noexcept
-			{
-				std::swap(level, i.level);
-				std::swap(gather, i.gather);
-				std::swap(name, i.name);
-			}
-			Item& operator = (const Item& i)
+			Item(const Item&) = delete;
+			Item& operator = (const Item&) = delete;
+			bool should_gather(int pri) const
 			{
-				level = i.level;
-				gather = i.gather;
-				name = i.name;
-				return *this;
+				return (pri < threshold.load(std::memory_order_relaxed));
 			}
-			Item& operator = (Item&& i) noexcept
+			// whether the logger itself wants pri, threshold may be raised for the flight recorder
+			bool keeps(int pri) const
 			{
-				std::swap(level, i.level);
-				std::swap(gather, i.gather);
-				std::swap(name, i.name);
-				return *this;
+				return (pri < std::max(level.load(std::memory_order_relaxed), gather.load(std::memory_order_relaxed)));
 			}
-			bool should_gather(int pri) const
+			void set(int l, int g, int r)
 			{
-				return ((pri < level) || (pri < gather));
+				level.store(l, std::memory_order_relaxed);
+				gather.store(g, std::memory_order_relaxed);
+				threshold.store(std::max(std::max(l, g), r), std::memory_order_relaxed);
 			}
 		public:
-			int level;
-			int gather;
-			std::string name;
+			std::atomic_int level;
+			std::atomic_int gather;
+			std::atomic_int threshold;		// max(level, gather, recorder), what dout_impl compares against
+			const std::string name;
 		};
 
+		// items never move or go away, so readers index them without the mutex; the
+		// table holding them is replaced by a larger copy when full, and old tables
+		// are kept until the map goes away like the name snapshots
+		static const size_t INIT_SUBSYS = 64;
 		using ItemMap = std::unordered_map<std::string, int>;
 		using lock_guard = std::lock_guard<std::mutex>;
 	public:
-		const SubsysMap::Item& item(int i)
+		SubsysMap()
+			: items_(nullptr)
+			, capacity_(0)
+			, size_(0)
+			, names_(nullptr)
+			, recorder_(INT_MIN)
+		{
+			maps_.push_back(std::unique_ptr<ItemMap>(new ItemMap));
+			names_.store(maps_.back().get());
+			grow(INIT_SUBSYS);
+		}
+		~SubsysMap()
+		{
+			size_t size = size_.load();
+			Item* const* items = items_.load();
+			for (size_t i = 0; i < size; ++i)
+			{
+				delete items[i];
+			}
+		}
+	public:
+		const SubsysMap::Item& item(int i) const
 		{
-			lock_guard l(mutex_);
 			size_t subsys = static_cast<size_t>(i);
-			if (subsys >= items_.size())
+			if (subsys >= size_.load(std::memory_order_acquire))
 			{
 				return defa_item_;
 			}
-			return items_[subsys];
+			return *items_.load(std::memory_order_acquire)[subsys];
 		}
-		int should_gather_log(const std::string& n, int pri)
+		/* Index of subsystem n or -1, without the mutex. */
+		int find(const std::string& n) const
 		{
-			lock_guard l(mutex_);
-			ItemMap::iterator iter = subsys_.find(n);
-			if (iter != subsys_.end())
+			const ItemMap* names = names_.load(std::memory_order_acquire);
+			ItemMap::const_iterator iter = names->find(n);
+			return ((iter != names->end()) ? iter->second : -1);
+		}
+		int should_gather_log(const std::string& n, int pri) const
+		{
+			int i = find(n);
+			if (i >= 0 && at(i)->should_gather(pri))
 			{
-				if (items_[iter->second].should_gather(pri))
-				{
-					return iter->second;
-				}
+				return i;
 			}
 			return -1;
 		}
+		/*
+		* Index of subsystem n. An unknown subsystem gets an item that gathers
+		* nothing until it is configured, as should_gather_log() treats it.
+		*/
+		int resolve(const std::string& n)
+		{
+			int i = find(n);
+			if (i >= 0)
+			{
+				return i;
+			}
+			lock_guard l(mutex_);
+			i = find(n);
+			if (i >= 0)
+			{
+				return i;
+			}
+			return insert(n, INT_MIN, INT_MIN);
+		}
 
 		void add(const std::string& n, int level, int gather)
 		{
@@ -101,23 +149,34 @@ namespace tiny
 				return;
 			}
 			lock_guard l(mutex_);
-			ItemMap::iterator iter = subsys_.find(n);
-			if (iter == subsys_.end())
+			int i = find(n);
+			if (i < 0)
 			{
-				subsys_[n] = items_.size();
-				items_.push_back(Item(level, gather, n));
+				insert(n, level, gather);
 				return;
 			}
-			items_[iter->second].level = level;
-			items_[iter->second].gather = gather;
+			at(i)->set(level, gather, recorder_);
+		}
+		/* Let every subsystem gather priorities below r for the flight recorder. */
+		void set_recorder(int r)
+		{
+			lock_guard l(mutex_);
+			recorder_ = r;
+			size_t size = size_.load();
+			for (size_t i = 0; i < size; ++i)
+			{
+				Item* item = at(i);
+				item->set(item->level.load(), item->gather.load(), recorder_);
+			}
 		}
 		void set_level(int i, int level)
 		{
 			lock_guard l(mutex_);
 			size_t subsys = static_cast<size_t>(i);
-			if (subsys < items_.size())
+			if (subsys < size_.load())
 			{
-				items_[subsys].level = level;
+				Item* item = at(subsys);
+				item->set(level, item->gather.load(), recorder_);
 			}
 			
 		}
@@ -125,42 +184,273 @@ namespace tiny
 		{
 			lock_guard l(mutex_);
 			size_t subsys = static_cast<size_t>(i);
-			if (subsys < items_.size()) 
+			if (subsys < size_.load()) 
 			{
-				items_[subsys].gather = gather;
+				Item* item = at(subsys);
+				item->set(item->level.load(), gather, recorder_);
 			}
 		}
 		void set_level(const std::string& n, int level)
 		{
 			lock_guard l(mutex_);
-			ItemMap::iterator iter = subsys_.find(n);
-			if (iter != subsys_.end())
+			int i = find(n);
+			if (i >= 0)
 			{
-				items_[iter->second].level = level;
+				Item* item = at(i);
+				item->set(level, item->gather.load(), recorder_);
 			}
 		}
 		void set_gather(const std::string& n, int gather)
 		{
 			lock_guard l(mutex_);
-			ItemMap::iterator iter = subsys_.find(n);
-			if (iter != subsys_.end())
+			int i = find(n);
+			if (i >= 0)
 			{
-				items_[iter->second].gather = gather;
+				Item* item = at(i);
+				item->set(item->level.load(), gather, recorder_);
 			}
 		}
 	private:
-		std::vector<Item> items_;
-		ItemMap subsys_;
+		Item* at(size_t i) const
+		{
+			return items_.load(std::memory_order_acquire)[i];
+		}
+		// call with mutex_ held (or from the constructor)
+		void grow(size_t capacity)
+		{
+			std::unique_ptr<Item*[]> items(new Item*[capacity]);
+			size_t size = size_.load(std::memory_order_relaxed);
+			for (size_t i = 0; i < size; ++i)
+			{
+				items[i] = tables_.back()[i];
+			}
+			items_.store(items.get(), std::memory_order_release);
+			tables_.push_back(std::move(items));
+			capacity_ = capacity;
+		}
+		// call with mutex_ held
+		int insert(const std::string& n, int level, int gather)
+		{
+			size_t size = size_.load(std::memory_order_relaxed);
+			if (size == capacity_)
+			{
+				grow(capacity_ * 2);
+			}
+			// the slot is stored before size_ is raised, and the table before both,
+			// so a reader that sees the new size also sees a table holding the item
+			tables_.back()[size] = new Item(level, gather, recorder_, n);
+			size_.store(size + 1, std::memory_order_release);
+			// publish a copy with n added; readers may still hold the old one, which is
+			// kept until the map goes away
+			std::unique_ptr<ItemMap> names(new ItemMap(*names_.load(std::memory_order_relaxed)));
+			(*names)[n] = static_cast<int>(size);
+			names_.store(names.get(), std::memory_order_release);
+			maps_.push_back(std::move(names));
+			return static_cast<int>(size);
+		}
+	private:
+		std::atomic<Item* const*> items_;		// current table, tables_.back()
+		std::vector<std::unique_ptr<Item*[]>> tables_;
+		size_t capacity_;
+		std::atomic<size_t> size_;
+		std::atomic<const ItemMap*> names_;		// current name -> index snapshot
+		std::vector<std::unique_ptr<ItemMap>> maps_;
 		Item defa_item_;
+		int recorder_;
 		std::mutex mutex_;
 	};
 
+	/*
+	*	class LogHeaderFormatter
+	*/
+
+	LogHeaderFormatter::LogHeaderFormatter()
+		: cached_sec_(-1)
+	{
+		date_[0] = '\0';
+	}
+
+	static inline char* log_header_append(char* pos, const char* str, size_t len)
+	{
+		memcpy(pos, str, len);
+		return pos + len;
+	}
+
+	size_t LogHeaderFormatter::format(char* buf, size_t len, const utime_t& stamp, const std::string& name, unsigned long thread, int prio)
+	{
+		if (len < (HEADER_RESERVE + name.size()))
+		{
+			utime_t t(stamp);
+			size_t used = (size_t)t.snprintf_t(buf, len);
+			if (used >= len)
+			{
+				return (len > 0) ? len - 1 : 0;
+			}
+			int ret = snprintf(buf + used, len - used, " <%s> thread id(0x%lx), log level(%2d) ", name.c_str(), thread, prio);
+			used += (ret > 0) ? (size_t)ret : 0;
+			return std::min(used, len - 1);
+		}
+		time_t sec = stamp.seconds();
+		if (sec != cached_sec_)
+		{
+			struct tm bdt;
+			utime_t t(stamp);
+			t.to_tm(&bdt);
+			snprintf(date_, sizeof(date_), "%04d-%02d-%02d %02d:%02d:%02d",
+				bdt.tm_year + 1900, bdt.tm_mon + 1, bdt.tm_mday,
+				bdt.tm_hour, bdt.tm_min, bdt.tm_sec);
+			cached_sec_ = sec;
+		}
+		char* pos = buf;
+		pos = log_header_append(pos, date_, strlen(date_));
+		*pos++ = '.';
+		long usec = stamp.microseconds();
+		for (int i = 5; i >= 0; --i)
+		{
+			pos[i] = (char)('0' + usec % 10);
+			usec /= 10;
+		}
+		pos += 6;
+		pos = log_header_append(pos, " <", 2);
+		pos = log_header_append(pos, name.data(), name.size());
+		pos = log_header_append(pos, "> thread id(0x", 14);
+
+		char digits[24];
+		char* d = digits + sizeof(digits);
+		do
+		{
+			*--d = "0123456789abcdef"[thread & 0xf];
+			thread >>= 4;
+		} while (thread);
+		pos = log_header_append(pos, d, digits + sizeof(digits) - d);
+		pos = log_header_append(pos, "), log level(", 13);
+
+		unsigned long v = (prio < 0) ? (0ul - (unsigned long)prio) : (unsigned long)prio;
+		d = digits + sizeof(digits);
+		do
+		{
+			*--d = (char)('0' + v % 10);
+			v /= 10;
+		} while (v);
+		if (prio < 0)
+		{
+			*--d = '-';
+		}
+		if ((digits + sizeof(digits) - d) < 2)
+		{
+			*--d = ' ';
+		}
+		pos = log_header_append(pos, d, digits + sizeof(digits) - d);
+		pos = log_header_append(pos, ") ", 2);
+		return pos - buf;
+	}
+
+	/*
+	*	class LogSubsys
+	*/
+
+	LogSubsys::LogSubsys(const char* name)
+		: index_(-1)
+		, threshold_(nullptr)
+	{
+		threshold_ = Logger::Instance()->resolve_subsys(name, &index_);
+	}
+
+	/*
+	*		class LogRateLimit
+	*/
+
+	static int64_t log_limit_now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	LogRateLimit::LogRateLimit(unsigned per_sec, unsigned burst)
+		: interval_(1000000000LL / std::max(per_sec, 1u))
+		, burst_(std::max(burst, 1u))
+		, tat_(0)
+		, suppressed_(0)
+		, last_hash_(0)
+		, last_pass_(0)
+		, repeated_(0)
+		, last_prio_(0)
+		, last_subsys_(-1)
+	{
+		Logger::Instance()->add_rate_limit(this);
+	}
+	LogRateLimit::~LogRateLimit()
+	{
+		Logger::Instance()->remove_rate_limit(this);
+	}
+	bool LogRateLimit::admit()
+	{
+		const int64_t now = log_limit_now();
+		int64_t tat = tat_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			int64_t next = std::max(tat, now) + interval_;
+			if (next - now > burst_ * interval_)
+			{
+				suppressed_.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			if (tat_.compare_exchange_weak(tat, next, std::memory_order_relaxed))
+			{
+				return true;
+			}
+		}
+	}
+	bool LogRateLimit::pass(const Entry& e, uint64_t* repeated, uint64_t* suppressed)
+	{
+		// FNV-1a
+		uint64_t hash = 14695981039346656037ULL;
+		for (char c : e.strv())
+		{
+			hash = (hash ^ (unsigned char)c) * 1099511628211ULL;
+		}
+		const int64_t now = log_limit_now();
+		std::lock_guard<spinlock> l(lock_);
+		last_prio_ = e.m_prio;
+		last_subsys_ = e.m_subsys;
+		if (hash == last_hash_ && now - last_pass_ < 1000000000LL)
+		{
+			++repeated_;
+			return false;
+		}
+		*repeated = repeated_;
+		*suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+		repeated_ = 0;
+		last_hash_ = hash;
+		last_pass_ = now;
+		return true;
+	}
+	bool LogRateLimit::take_pending(bool all, short* prio, int* subsys, uint64_t* repeated, uint64_t* suppressed)
+	{
+		const int64_t now = log_limit_now();
+		std::lock_guard<spinlock> l(lock_);
+		if (last_subsys_ < 0 || (!all && now - last_pass_ < 1000000000LL))
+		{
+			return false;
+		}
+		*repeated = repeated_;
+		*suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+		repeated_ = 0;
+		*prio = last_prio_;
+		*subsys = last_subsys_;
+		return (*repeated > 0 || *suppressed > 0);
+	}
+
 	/*
 	*		class InnerLogWriterImpl
+	*
+	*	The default writer. Every save_days the file is renamed to
+	*	"<path>.<yyyymmdd-hhmmss>" and a new one started; the previous KEEP_FILES
+	*	periods are kept, gzipped by a LogRotateWorker.
 	*/
 
 	class InnerLogWriterImpl : public Logger::WriterImpl
 	{
+		static const unsigned KEEP_FILES = 1;
 	public:
 		InnerLogWriterImpl(int save_days, const std::string& path)
 			: save_days_(save_days)
@@ -179,7 +469,7 @@ namespace tiny
 			}
 			lastest_open_ = file_.GetCreateTime();
 		}
-		~InnerLogWriterImpl() override {}
+		~InnerLogWriterImpl() override;
 	public:
 		void Write(const char* data, size_t len) override
 		{
@@ -187,6 +477,28 @@ namespace tiny
 			{
 				return;
 			}
+			write_all(data, len);
+			file_.Flush();
+		}
+		void WriteV(const stringview* bufs, size_t count) override
+		{
+			if (!reopen())
+			{
+				return;
+			}
+			for (size_t i = 0; i < count; ++i)
+			{
+				write_all(bufs[i].data(), bufs[i].size());
+			}
+			file_.Flush();
+		}
+		void Print(const char* data, size_t len) override 
+		{
+			std::cout << stringview(data, len) << std::endl;
+		}
+	protected:
+		void write_all(const char* data, size_t len)
+		{
 			size_t pos = 0;
 			size_t ws = len;
 			while (pos < ws)
@@ -208,35 +520,20 @@ namespace tiny
 				}
 
 			}
-			file_.Flush();
-		}
-		void Print(const char* data, size_t len) override 
-		{
-			std::cout << stringview(data, len) << std::endl;
 		}
-	protected:
 		bool reopen()
 		{
 			utime_t now = utime_t::now();
 			if ((now - lastest_open_).to_days() > save_days_)
 			{
 				file_.Close();
+				rotate();
 				lastest_open_ = now;
 			}
-			else
-			{
-				if (!file_)
-				{
-					if (!file_.Open("a"))
-					{
-						std::cout << "open log [" << file_.Path() << "] file failed" << std::endl;
-						return false;
-					}
-				}
-			}
 			if (!file_)
 			{
-				if (!file_.Open("w"))
+				// never "w": a failed rotation keeps appending rather than losing the file
+				if (!file_.Open("a"))
 				{
 					std::cout << "open log [" << file_.Path() << "] file failed" << std::endl;
 					return false;
@@ -248,136 +545,1446 @@ namespace tiny
 			}
 			return true;
 		}
+		void rotate();
 	private:
 		File file_;
 		int save_days_;
 		utime_t lastest_open_;
+		std::unique_ptr<LogRotateWorker> rotate_worker_;
 	};
 
 
 	/*
-	*	class Logger
+	*	class LogFormat
 	*/
 
-	class OnAppExitManager
+	LogFormat::LogFormat(const char* fmt)
+		: fmt_(fmt ? fmt : "")
 	{
-	public:
-		OnAppExitManager()
-			: logger(nullptr)
-		{
-			logger = new Logger;
-		}
-		~OnAppExitManager()
+		const char* p = fmt_;
+		size_t begin = 0;
+		while (*p)
 		{
-			logger->stop();
-			delete logger;
+			if (*p != '%')
+			{
+				literals_.push_back(*p++);
+				continue;
+			}
+			if (p[1] == '%')
+			{
+				literals_.push_back('%');
+				p += 2;
+				continue;
+			}
+			Spec spec;
+			spec.literal_begin = begin;
+			spec.literal_end = literals_.size();
+			spec.precision = -1;
+			spec.star_width = false;
+			spec.star_precision = false;
+			++p;
+			while (*p && strchr("-+ #0123456789", *p))
+			{
+				spec.flags.push_back(*p++);
+			}
+			if (*p == '*')
+			{
+				++p;
+				spec.star_width = true;
+			}
+			if (*p == '.')
+			{
+				++p;
+				spec.precision = 0;
+				if (*p == '*')
+				{
+					++p;
+					spec.star_precision = true;
+				}
+				while (*p >= '0' && *p <= '9')
+				{
+					spec.precision = spec.precision * 10 + (*p++ - '0');
+				}
+			}
+			// the argument type is known from its tag, length modifiers are dropped
+			while (*p && strchr("hlLqjzt", *p))
+			{
+				++p;
+			}
+			if (!*p)
+			{
+				break;
+			}
+			spec.conv = *p++;
+			specs_.push_back(spec);
+			begin = literals_.size();
 		}
-		Logger* get_logger() { return logger; }
-	private:
-		Logger* logger;
-	};
-#define MAX_LOG_BUF             65536
-	Logger::Logger()
-		: to_stop_(false)
-		, started_(false)
-		, m_gather_level_(-1)
-		, m_log_level_(-1)
-		, m_subs(new SubsysMap)
-		, new_entries_max_(80)
-	{
-
-	}
-	Logger::~Logger()
-	{
-		delete m_subs;
+		Spec tail;
+		tail.literal_begin = begin;
+		tail.literal_end = literals_.size();
+		tail.precision = -1;
+		tail.star_width = false;
+		tail.star_precision = false;
+		tail.conv = 0;
+		specs_.push_back(tail);
 	}
 
-	Logger* Logger::Instance()
-	{
-		static OnAppExitManager on_appexit_manager;
-		return on_appexit_manager.get_logger();
-	}
-
-	int Logger::initialize(int save_days, const std::string& path, std::unique_ptr<WriterImpl> writer_impl)
+	template<typename T>
+	static void log_format_append(std::vector<char>& out, const std::string& spec, T v)
 	{
-		if (thread_.joinable())
+		char buf[64];
+		int n = snprintf(buf, sizeof(buf), spec.c_str(), v);
+		if (n <= 0)
 		{
-			return -1;
-		}
-		if (!writer_impl)
-		{
-			writer_impl_.reset(new InnerLogWriterImpl(save_days, path));
+			return;
 		}
-		else
+		if ((size_t)n < sizeof(buf))
 		{
-			writer_impl_ = std::move(writer_impl);
+			out.insert(out.end(), buf, buf + n);
+			return;
 		}
-
-#ifdef TINY_DEBUG
-		set_log_subsys("tiny_sqlite3", 5, 5);
-#else
-		set_log_subsys("tiny_sqlite3", 1, 1);
-#endif // TINY_DEBUG
-
-
-		return start();
+		size_t cur = out.size();
+		out.resize(cur + n + 1);
+		snprintf(out.data() + cur, n + 1, spec.c_str(), v);
+		out.resize(cur + n);
 	}
 
-	void Logger::submit_entry(Entry&& e)
+	/* Reads an integer argument for a '*' width or precision. */
+	static bool log_format_star(const char*& pos, const char* end, int* v)
 	{
-		unique_lock l(queue_entry_mutex_);
-		if (new_entries_.size() >= new_entries_max_)
+		if ((size_t)(end - pos) < 9 || (*pos != LogFormat::arg_int && *pos != LogFormat::arg_uint))
 		{
-			queue_entry_cond_.wait(l, [this] { return ((new_entries_.size() < new_entries_max_) || to_stop_); });
+			return false;
 		}
-		new_entries_.emplace_back(std::move(e));
-		flush_entry_cond_.notify_all();
-	}
-
-	int Logger::should_gather_log(const std::string& n, int pri)
-	{
-		return m_subs->should_gather_log(n, pri);
-	}
-
-	void Logger::set_log_gather(const std::string& subsys, int gather)
-	{
-		m_subs->set_gather(subsys, gather);
+		int64_t i;
+		memcpy(&i, pos + 1, sizeof(i));
+		pos += 9;
+		*v = (int)i;
+		return true;
 	}
 
-	void Logger::set_log_level(const std::string& subsys, int level)
-	{
-		m_subs->set_level(subsys, level);
-	}
-
-	void Logger::set_log_subsys(const std::string& subsys, int log_level, int gather_level)
-	{
-		m_subs->add(subsys, log_level, gather_level);
-	}
-
-	void Logger::set_log_level(int l)
-	{
-		m_log_level_ = l;
-	}
-
-	void Logger::set_gather_level(int g)
+	void LogFormat::format(stringview args, std::vector<char>& out) const
 	{
-		m_gather_level_ = g;
-	}
-
-	int Logger::start()
-	{
-		unique_lock l(queue_entry_mutex_);
-		if (started_ || thread_.joinable())
+		const char* pos = args.data();
+		const char* end = pos + args.size();
+		std::string spec;
+		for (const Spec& s : specs_)
 		{
-			return -1;
-		}
-		thread_ = std::thread([this] {run(); });
-		queue_entry_cond_.wait(l, [this] {return started_; });
-		return ((!started_) ? -1 : 0);
-	}
-
-	void Logger::stop()
-	{
+			out.insert(out.end(), literals_.data() + s.literal_begin, literals_.data() + s.literal_end);
+			if (s.conv == 0)
+			{
+				break;
+			}
+			int width = 0;
+			int precision = s.precision;
+			if ((s.star_width && !log_format_star(pos, end, &width))
+				|| (s.star_precision && !log_format_star(pos, end, &precision))
+				|| pos >= end)
+			{
+				// fewer arguments than conversions
+				out.push_back('%');
+				out.push_back(s.conv);
+				continue;
+			}
+			char type = *pos++;
+			spec.assign(1, '%');
+			spec.append(s.flags);
+			if (s.star_width)
+			{
+				// a negative width is the '-' flag, as with printf
+				spec.append(std::to_string(width));
+			}
+			if (type == arg_str)
+			{
+				uint32_t len = 0;
+				if ((size_t)(end - pos) < sizeof(len))
+				{
+					break;
+				}
+				memcpy(&len, pos, sizeof(len));
+				pos += sizeof(len);
+				if ((size_t)(end - pos) < len)
+				{
+					break;
+				}
+				int shown = (int)len;
+				if (precision >= 0 && precision < shown)
+				{
+					shown = precision;
+				}
+				if (spec.size() == 1)
+				{
+					out.insert(out.end(), pos, pos + shown);
+				}
+				else
+				{
+					spec.append(".*s");
+					char buf[64];
+					int n = snprintf(buf, sizeof(buf), spec.c_str(), shown, pos);
+					if (n > 0 && (size_t)n < sizeof(buf))
+					{
+						out.insert(out.end(), buf, buf + n);
+					}
+					else
+					{
+						out.insert(out.end(), pos, pos + shown);
+					}
+				}
+				pos += len;
+				continue;
+			}
+			if (precision >= 0)
+			{
+				spec.push_back('.');
+				spec.append(std::to_string(precision));
+			}
+			if ((size_t)(end - pos) < 8)
+			{
+				break;
+			}
+			if (type == arg_double)
+			{
+				double d;
+				memcpy(&d, pos, sizeof(d));
+				pos += sizeof(d);
+				if (strchr("feEgGaA", s.conv))
+				{
+					spec.push_back(s.conv);
+					log_format_append(out, spec, d);
+				}
+				else
+				{
+					spec.push_back('g');
+					log_format_append(out, spec, d);
+				}
+				continue;
+			}
+			uint64_t u;
+			memcpy(&u, pos, sizeof(u));
+			pos += sizeof(u);
+			if (type == arg_ptr || s.conv == 'p')
+			{
+				spec.push_back('p');
+				log_format_append(out, spec, (void*)(uintptr_t)u);
+			}
+			else if (strchr("feEgGaA", s.conv))
+			{
+				spec.push_back(s.conv);
+				log_format_append(out, spec, (type == arg_int) ? (double)(int64_t)u : (double)u);
+			}
+			else if (s.conv == 'c')
+			{
+				spec.push_back('c');
+				log_format_append(out, spec, (int)u);
+			}
+			else if (strchr("uxXo", s.conv) || (type == arg_uint && s.conv != 'd' && s.conv != 'i'))
+			{
+				spec.append("ll");
+				spec.push_back(strchr("uxXo", s.conv) ? s.conv : 'u');
+				log_format_append(out, spec, (unsigned long long)u);
+			}
+			else
+			{
+				spec.append("lld");
+				log_format_append(out, spec, (long long)(int64_t)u);
+			}
+		}
+	}
+
+	/*
+	*	class LogArena
+	*/
+
+	/*
+	* state is gen << 32 | OWNED | entries. OWNED is set while a thread fills the
+	* chunk; gen changes when the chunk is taken away from that thread, so the
+	* thread's next reserve fails its CAS instead of writing into a reused chunk.
+	*/
+	struct LogArena::Chunk
+	{
+		static const uint64_t OWNED = 1u << 31;
+		static const uint64_t REFS = OWNED - 1;
+
+		LogArena* owner;
+		std::atomic<uint64_t> state;
+		std::atomic<size_t> used;
+		char* data;
+	};
+
+	/*
+	*	The chunk the calling thread is currently filling, and a reference on the
+	*	arena, which keeps the chunk memory valid even after the chunk was stolen.
+	*/
+	struct LogArenaCursor
+	{
+		LogArenaCursor() : arena(nullptr), chunk(nullptr), gen(0) {}
+		~LogArenaCursor()
+		{
+			detach();
+		}
+		void detach()
+		{
+			if (chunk)
+			{
+				LogArena::disown(chunk, gen);
+				chunk = nullptr;
+			}
+			if (arena)
+			{
+				arena->unref();
+				arena = nullptr;
+			}
+		}
+		LogArena* arena;
+		LogArena::Chunk* chunk;
+		uint32_t gen;
+	};
+	static thread_local LogArenaCursor log_arena_cursor;
+
+	LogArena::LogArena(size_t chunk_size, size_t chunks)
+		: chunk_size_(chunk_size)
+		, refs_(1)
+	{
+		chunks_.reserve(chunks);
+		free_.reserve(chunks);
+		for (size_t i = 0; i < chunks; ++i)
+		{
+			Chunk* c = new Chunk;
+			c->owner = this;
+			c->state.store(0, std::memory_order_relaxed);
+			c->used.store(0, std::memory_order_relaxed);
+			c->data = new char[chunk_size_];
+			chunks_.push_back(c);
+			free_.push_back(c);
+		}
+	}
+	LogArena::~LogArena()
+	{
+		for (Chunk* c : chunks_)
+		{
+			delete[] c->data;
+			delete c;
+		}
+	}
+	char* LogArena::reserve(size_t len, Chunk** chunk)
+	{
+		LogArenaCursor& cursor = log_arena_cursor;
+		if (cursor.arena != this)
+		{
+			cursor.detach();
+			ref();
+			cursor.arena = this;
+		}
+		if (len > chunk_size_ / 4)
+		{
+			return nullptr;
+		}
+		for (int attempt = 0; attempt < 2; ++attempt)
+		{
+			Chunk* c = cursor.chunk;
+			if (!c)
+			{
+				c = cursor.chunk = acquire(&cursor.gen);
+				if (!c)
+				{
+					return nullptr;
+				}
+			}
+			uint64_t s = c->state.load(std::memory_order_acquire);
+			while ((uint32_t)(s >> 32) == cursor.gen && (s & Chunk::OWNED))
+			{
+				size_t used = c->used.load(std::memory_order_relaxed);
+				if (used + len > chunk_size_)
+				{
+					break;
+				}
+				// an entry reference pins the chunk, it can't be stolen from here on
+				if (c->state.compare_exchange_weak(s, s + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+				{
+					c->used.store(used + len, std::memory_order_relaxed);
+					*chunk = c;
+					return c->data + used;
+				}
+			}
+			// full, or taken away while this thread was idle
+			disown(c, cursor.gen);
+			cursor.chunk = nullptr;
+		}
+		return nullptr;
+	}
+	void LogArena::release(Chunk* chunk)
+	{
+		uint64_t s = chunk->state.fetch_sub(1, std::memory_order_acq_rel);
+		if ((s & (Chunk::OWNED | Chunk::REFS)) == 1)
+		{
+			chunk->owner->recycle(chunk);
+		}
+	}
+	void LogArena::disown(Chunk* chunk, uint32_t gen)
+	{
+		uint64_t s = chunk->state.load(std::memory_order_acquire);
+		while ((uint32_t)(s >> 32) == gen && (s & Chunk::OWNED))
+		{
+			if (chunk->state.compare_exchange_weak(s, s & ~Chunk::OWNED, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				if ((s & Chunk::REFS) == 0)
+				{
+					chunk->owner->recycle(chunk);
+				}
+				return;
+			}
+		}
+	}
+	LogArena::Chunk* LogArena::acquire(uint32_t* gen)
+	{
+		Chunk* c = nullptr;
+		free_lock_.lock();
+		if (!free_.empty())
+		{
+			c = free_.back();
+			free_.pop_back();
+		}
+		free_lock_.unlock();
+		if (!c)
+		{
+			return steal(gen);
+		}
+		uint64_t s = c->state.load(std::memory_order_relaxed);
+		*gen = (uint32_t)(s >> 32);
+		c->used.store(0, std::memory_order_relaxed);
+		c->state.store(s | Chunk::OWNED, std::memory_order_release);
+		return c;
+	}
+	LogArena::Chunk* LogArena::steal(uint32_t* gen)
+	{
+		for (Chunk* c : chunks_)
+		{
+			uint64_t s = c->state.load(std::memory_order_acquire);
+			if ((s & (Chunk::OWNED | Chunk::REFS)) != Chunk::OWNED)
+			{
+				continue;
+			}
+			uint32_t next = (uint32_t)(s >> 32) + 1;
+			uint64_t mine = ((uint64_t)next << 32) | Chunk::OWNED;
+			if (c->state.compare_exchange_strong(s, mine, std::memory_order_acq_rel))
+			{
+				c->used.store(0, std::memory_order_relaxed);
+				*gen = next;
+				return c;
+			}
+		}
+		return nullptr;
+	}
+	void LogArena::unref()
+	{
+		if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			delete this;
+		}
+	}
+	void LogArena::recycle(Chunk* chunk)
+	{
+		free_lock_.lock();
+		free_.push_back(chunk);
+		free_lock_.unlock();
+	}
+
+	/*
+	*	class Logger::EntryRing
+	*
+	*	Bounded ring written by exactly one producer thread. Every cell carries a
+	*	sequence number, so the owning producer may also pop (drop_oldest) while
+	*	the logger thread drains it.
+	*/
+
+	class Logger::EntryRing
+	{
+		struct Cell
+		{
+			std::atomic<size_t> seq;
+			typename std::aligned_storage<sizeof(ConcreteEntry), alignof(ConcreteEntry)>::type storage;
+		};
+	public:
+		explicit EntryRing(size_t entries)
+			: mask_(0)
+			, cells_(nullptr)
+			, head_(0)
+			, tail_(0)
+			, closed_(false)
+		{
+			size_t size = 2;
+			while (size < entries)
+			{
+				size <<= 1;
+			}
+			mask_ = size - 1;
+			cells_ = new Cell[size];
+			for (size_t i = 0; i < size; ++i)
+			{
+				cells_[i].seq.store(i, std::memory_order_relaxed);
+			}
+		}
+		~EntryRing()
+		{
+			ConcreteEntry* e = nullptr;
+			while ((e = front()) != nullptr)
+			{
+				e->~ConcreteEntry();
+				pop_front();
+			}
+			delete[] cells_;
+		}
+		EntryRing(const EntryRing&) = delete;
+		EntryRing& operator = (const EntryRing&) = delete;
+	public:
+		// producer only
+		bool push(ConcreteEntry&& e)
+		{
+			size_t pos = tail_.load(std::memory_order_relaxed);
+			Cell& cell = cells_[pos & mask_];
+			if (cell.seq.load(std::memory_order_acquire) != pos)
+			{
+				return false;
+			}
+			new (&cell.storage) ConcreteEntry(std::move(e));
+			cell.seq.store(pos + 1, std::memory_order_release);
+			tail_.store(pos + 1, std::memory_order_relaxed);
+			return true;
+		}
+		bool pop(EntryVector* out)
+		{
+			size_t pos = head_.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				Cell& cell = cells_[pos & mask_];
+				size_t seq = cell.seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+				if (diff == 0)
+				{
+					if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						ConcreteEntry* e = reinterpret_cast<ConcreteEntry*>(&cell.storage);
+						if (out)
+						{
+							out->emplace_back(std::move(*e));
+						}
+						e->~ConcreteEntry();
+						cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					pos = head_.load(std::memory_order_relaxed);
+				}
+			}
+		}
+		bool empty() const
+		{
+			return (head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire));
+		}
+		void close() { closed_.store(true, std::memory_order_release); }
+		bool closed() const { return closed_.load(std::memory_order_acquire); }
+	private:
+		// only used once no other thread can touch the ring
+		ConcreteEntry* front()
+		{
+			size_t pos = head_.load(std::memory_order_relaxed);
+			Cell& cell = cells_[pos & mask_];
+			if (cell.seq.load(std::memory_order_acquire) != pos + 1)
+			{
+				return nullptr;
+			}
+			return reinterpret_cast<ConcreteEntry*>(&cell.storage);
+		}
+		void pop_front()
+		{
+			size_t pos = head_.load(std::memory_order_relaxed);
+			cells_[pos & mask_].seq.store(pos + mask_ + 1, std::memory_order_relaxed);
+			head_.store(pos + 1, std::memory_order_relaxed);
+		}
+	private:
+		size_t mask_;
+		Cell* cells_;
+		char pad0_[64];
+		std::atomic<size_t> head_;
+		char pad1_[64];
+		std::atomic<size_t> tail_;
+		std::atomic_bool closed_;
+	};
+
+	/*
+	*	The ring of the calling thread. It is shared with Logger::rings_ and closed
+	*	when the thread exits, the logger thread then releases it once drained.
+	*/
+	struct LoggerRingHolder
+	{
+		~LoggerRingHolder()
+		{
+			if (ring)
+			{
+				ring->close();
+			}
+		}
+		std::shared_ptr<Logger::EntryRing> ring;
+	};
+	static thread_local LoggerRingHolder logger_ring_holder;
+
+	/*
+	*	class Logger
+	*/
+
+	/*
+	*		class LogSink
+	*
+	*	Formatted lines bound for one writer, written out on the sink's own thread.
+	*/
+
+	class LogSink : public Thread
+	{
+	public:
+		LogSink(Logger::WriterImpl* writer, int level, size_t max_bytes, bool print)
+			: writer_(writer)
+			, level_(level)
+			, max_bytes_(max_bytes)
+			, print_(print)
+			, stop_(false)
+			, dropped_(0)
+		{
+		}
+		~LogSink() override
+		{
+			stop();
+		}
+	public:
+		int level() const { return level_; }
+		uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+		void own(std::unique_ptr<Logger::WriterImpl> writer)
+		{
+			owned_ = std::move(writer);
+			writer_ = owned_.get();
+		}
+		void push(const stringview* parts, size_t count)
+		{
+			size_t len = 0;
+			for (size_t i = 0; i < count; ++i)
+			{
+				len += parts[i].size();
+			}
+			lock_guard l(mutex_);
+			if (buf_.size() + len > max_bytes_)
+			{
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			const bool was_empty = buf_.empty();
+			for (size_t i = 0; i < count; ++i)
+			{
+				buf_.insert(buf_.end(), parts[i].begin(), parts[i].end());
+			}
+			ends_.push_back(buf_.size());
+			if (was_empty)
+			{
+				cond_.notify_one();
+			}
+		}
+	protected:
+		void on_stop() override
+		{
+			lock_guard l(mutex_);
+			stop_ = true;
+			cond_.notify_one();
+		}
+		void run() override
+		{
+			std::vector<char> out;
+			std::vector<size_t> out_ends;
+			unique_lock l(mutex_);
+			for (;;)
+			{
+				while (buf_.empty() && !stop_)
+				{
+					cond_.wait(l);
+				}
+				if (buf_.empty())
+				{
+					break;
+				}
+				out.swap(buf_);
+				out_ends.swap(ends_);
+				l.unlock();
+				if (!print_)
+				{
+					writer_->Write(out.data(), out.size());
+				}
+				else
+				{
+					size_t begin = 0;
+					for (size_t end : out_ends)
+					{
+						writer_->Print(out.data() + begin, end - begin);
+						begin = end;
+					}
+				}
+				out.clear();
+				out_ends.clear();
+				l.lock();
+			}
+		}
+	private:
+		Logger::WriterImpl* writer_;
+		std::unique_ptr<Logger::WriterImpl> owned_;
+		int level_;
+		size_t max_bytes_;
+		bool print_;
+		bool stop_;
+		std::atomic<uint64_t> dropped_;
+		std::mutex mutex_;
+		std::condition_variable cond_;
+		std::vector<char> buf_;
+		std::vector<size_t> ends_;
+	};
+
+	/*
+	*		class FlightRecorder
+	*
+	*	The last entries submitted, in fixed slots written lock-free by the producers.
+	*	Each slot is guarded by a sequence number: odd while it is written, 2 * (n + 1)
+	*	once it holds entry n, so a dump skips slots that are torn or overwritten.
+	*/
+
+	class FlightRecorder
+	{
+		struct Slot
+		{
+			std::atomic<uint64_t> seq;
+			utime_t stamp;
+			unsigned long thread;
+			short prio;
+			int subsys;
+			uint32_t len;
+		};
+	public:
+		FlightRecorder(size_t slots, size_t slot_size, const SubsysMap* subs, const std::string& path)
+			: subs_(subs)
+			, path_(path)
+			, head_(0)
+			, dumping_(false)
+			, crashed_(false)
+		{
+			size_t n = 1;
+			while (n < slots)
+			{
+				n <<= 1;
+			}
+			mask_ = n - 1;
+			text_size_ = slot_size;
+			text_copy_.resize(slot_size + 1);
+			stride_ = (sizeof(Slot) + slot_size + 63) & ~(size_t)63;
+			storage_.resize(n * stride_ + 64);
+			base_ = storage_.data() + ((64 - ((uintptr_t)storage_.data() & 63)) & 63);
+			for (size_t i = 0; i < n; ++i)
+			{
+				new (slot(i)) Slot();
+				slot(i)->seq.store(0, std::memory_order_relaxed);
+			}
+		}
+	public:
+		void record(const Entry& e)
+		{
+			stringview str = e.strv();
+			if (e.m_format)
+			{
+				static thread_local std::vector<char> buf;
+				buf.clear();
+				e.m_format->format(str, buf);
+				str = stringview(buf.data(), buf.size());
+			}
+			uint64_t n = head_.fetch_add(1, std::memory_order_relaxed);
+			Slot* s = slot((size_t)(n & mask_));
+			s->seq.store(2 * n + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			s->stamp = e.m_stamp;
+			s->thread = e.m_thread;
+			s->prio = e.m_prio;
+			s->subsys = e.m_subsys;
+			s->len = (uint32_t)std::min(str.size(), text_size_);
+			memcpy(text(s), str.data(), s->len);
+			s->seq.store(2 * (n + 1), std::memory_order_release);
+		}
+		/*
+		 * Writes the recorded entries, oldest first, to the dump file. Meant for a
+		 * crashing process: no locks and no allocation except for the formatter's
+		 * localtime; a call made while another one runs does nothing.
+		 */
+		int dump()
+		{
+			if (dumping_.exchange(true))
+			{
+				return -1;
+			}
+#ifndef UNI_WIN
+			int fd = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#else
+			int fd = ::_open(path_.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#endif // !UNI_WIN
+			if (fd < 0)
+			{
+				return -1;
+			}
+			LogHeaderFormatter header;
+			char line[LogHeaderFormatter::HEADER_RESERVE + 256];
+			uint64_t end = head_.load(std::memory_order_acquire);
+			uint64_t begin = (end > mask_ + 1) ? end - (mask_ + 1) : 0;
+			for (uint64_t n = begin; n < end; ++n)
+			{
+				Slot* s = slot((size_t)(n & mask_));
+				uint64_t seq = s->seq.load(std::memory_order_acquire);
+				if (seq != 2 * (n + 1))
+				{
+					continue;
+				}
+				// copy everything out first, a producer may reuse the slot until seq is checked again
+				utime_t stamp = s->stamp;
+				unsigned long thread = s->thread;
+				short prio = s->prio;
+				int subsys = s->subsys;
+				uint32_t len = std::min(s->len, (uint32_t)text_size_);
+				memcpy(text_copy_.data(), text(s), len);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (s->seq.load(std::memory_order_relaxed) != seq)
+				{
+					continue;
+				}
+				const SubsysMap::Item& item = subs_->item(subsys);
+				size_t used = header.format(line, sizeof(line), stamp, item.name, thread, prio);
+				write_all(fd, line, used);
+				write_all(fd, text_copy_.data(), len);
+				write_all(fd, "\n", 1);
+			}
+#ifndef UNI_WIN
+			::fsync(fd);
+			::close(fd);
+#else
+			::_commit(fd);
+			::_close(fd);
+#endif // !UNI_WIN
+			dumping_.store(false);
+			return 0;
+		}
+		/*
+		 * Dump for a dying process, only the first time: tiny_abort dumps and then
+		 * aborts, and the SIGABRT handler must not overwrite that dump.
+		 */
+		int dump_on_crash()
+		{
+			if (crashed_.exchange(true))
+			{
+				return -1;
+			}
+			return dump();
+		}
+	private:
+		Slot* slot(size_t i) { return reinterpret_cast<Slot*>(base_ + i * stride_); }
+		char* text(Slot* s) { return reinterpret_cast<char*>(s) + sizeof(Slot); }
+		static void write_all(int fd, const char* data, size_t len)
+		{
+			while (len > 0)
+			{
+#ifndef UNI_WIN
+				ssize_t ret = ::write(fd, data, len);
+#else
+				int ret = ::_write(fd, data, (unsigned int)len);
+#endif // !UNI_WIN
+				if (ret < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				if (ret <= 0)
+				{
+					return;
+				}
+				data += ret;
+				len -= (size_t)ret;
+			}
+		}
+	private:
+		const SubsysMap* subs_;
+		std::string path_;
+		std::vector<char> storage_;
+		char* base_;
+		size_t mask_;
+		size_t stride_;
+		size_t text_size_;
+		std::vector<char> text_copy_;		// a slot's text while dump() checks it, allocated up front
+		std::atomic<uint64_t> head_;
+		std::atomic_bool dumping_;
+		std::atomic_bool crashed_;
+	};
+
+	static std::atomic<FlightRecorder*> g_flight_recorder(nullptr);
+
+	static void flight_recorder_dump()
+	{
+		FlightRecorder* recorder = g_flight_recorder.load();
+		if (recorder)
+		{
+			recorder->dump_on_crash();
+		}
+	}
+#ifndef UNI_WIN
+	// the handlers installed before set_flight_recorder, restored on a fatal signal
+	static struct sigaction g_old_sigactions[NSIG];
+
+	static void flight_recorder_on_signal(int sig, siginfo_t* info, void*)
+	{
+		flight_recorder_dump();
+		::sigaction(sig, &g_old_sigactions[sig], nullptr);
+		// a fault re-executes the instruction once we return and reaches the old
+		// handler with its own siginfo; a sent signal (abort, kill) has to be raised again
+		if (info == nullptr || info->si_code <= 0 || sig == SIGABRT)
+		{
+			::raise(sig);
+		}
+	}
+#endif // !UNI_WIN
+
+	class OnAppExitManager
+	{
+	public:
+		OnAppExitManager()
+			: logger(nullptr)
+		{
+			logger = new Logger;
+		}
+		~OnAppExitManager()
+		{
+			logger->stop();
+			delete logger;
+		}
+		Logger* get_logger() { return logger; }
+	private:
+		Logger* logger;
+	};
+#define MAX_LOG_BUF             65536
+	Logger::Logger()
+		: to_stop_(false)
+		, started_(false)
+		, m_gather_level_(-1)
+		, m_log_level_(-1)
+		, m_subs(new SubsysMap)
+		, new_entries_max_(80)
+		, m_pending_bytes(0)
+		, arena_(nullptr)
+		, print_queue_bytes_(0)
+		, recorder_(nullptr)
+		, ring_entries_(0)
+		, ring_policy_(OverflowPolicy::block)
+		, dropped_entries_(0)
+		, consumer_parked_(false)
+		, blocked_producers_(0)
+	{
+
+	}
+	Logger::~Logger()
+	{
+		if (recorder_)
+		{
+			// abort hooks and signal handlers may still find it
+			g_flight_recorder.store(nullptr);
+			set_tiny_abort_hook(nullptr);
+		}
+		delete recorder_;
+		print_sink_.reset();
+		sinks_.clear();
+		delete m_subs;
+		if (arena_)
+		{
+			// threads that logged through it keep it until they exit
+			arena_->close();
+		}
+	}
+
+	Logger* Logger::Instance()
+	{
+		static OnAppExitManager on_appexit_manager;
+		return on_appexit_manager.get_logger();
+	}
+
+	int Logger::initialize(int save_days, const std::string& path, std::unique_ptr<WriterImpl> writer_impl)
+	{
+		if (thread_.joinable())
+		{
+			return -1;
+		}
+		if (!writer_impl)
+		{
+			writer_impl_.reset(new InnerLogWriterImpl(save_days, path));
+		}
+		else
+		{
+			writer_impl_ = std::move(writer_impl);
+		}
+		if (print_queue_bytes_ > 0)
+		{
+			print_sink_.reset(new LogSink(writer_impl_.get(), INT_MAX, print_queue_bytes_, true));
+			print_sink_->start();
+		}
+
+#ifdef TINY_DEBUG
+		set_log_subsys("tiny_sqlite3", 5, 5);
+#else
+		set_log_subsys("tiny_sqlite3", 1, 1);
+#endif // TINY_DEBUG
+
+
+		return start();
+	}
+
+	static void format_limit_note(MutableEntry& note, uint64_t repeated, uint64_t suppressed)
+	{
+		if (repeated > 0)
+		{
+			note.get_ostream() << "last message repeated " << repeated << " times";
+		}
+		if (suppressed > 0)
+		{
+			note.get_ostream() << (repeated > 0 ? ", " : "") << suppressed << " messages dropped by the rate limit";
+		}
+		note.get_ostream() << std::flush;
+	}
+
+	void Logger::submit_entry(Entry&& e)
+	{
+		if (e.m_limit)
+		{
+			uint64_t repeated = 0;
+			uint64_t suppressed = 0;
+			if (!e.m_limit->pass(e, &repeated, &suppressed))
+			{
+				return;
+			}
+			if (repeated > 0 || suppressed > 0)
+			{
+				MutableEntry note(e.m_prio, e.m_subsys);
+				format_limit_note(note, repeated, suppressed);
+				submit_entry(std::move(note));
+			}
+		}
+		if (recorder_)
+		{
+			recorder_->record(e);
+			if (!m_subs->item(e.m_subsys).keeps(e.m_prio))
+			{
+				return;
+			}
+		}
+		if (arena_)
+		{
+			enqueue_entry(ConcreteEntry(e, *arena_));
+		}
+		else
+		{
+			enqueue_entry(ConcreteEntry(e));
+		}
+	}
+
+	void Logger::enqueue_entry(ConcreteEntry&& e)
+	{
+		if (ring_entries_ > 0)
+		{
+			submit_to_ring(std::move(e));
+			return;
+		}
+		unique_lock l(queue_entry_mutex_);
+		if (new_entries_.size() >= new_entries_max_)
+		{
+			queue_entry_cond_.wait(l, [this] { return ((new_entries_.size() < new_entries_max_) || to_stop_); });
+		}
+		new_entries_.emplace_back(std::move(e));
+		flush_entry_cond_.notify_all();
+	}
+
+	int Logger::should_gather_log(const std::string& n, int pri)
+	{
+		return m_subs->should_gather_log(n, pri);
+	}
+
+	const std::atomic_int* Logger::resolve_subsys(const std::string& n, int* index)
+	{
+		static const std::atomic_int gather_none(INT_MIN);
+		int i = m_subs->resolve(n);
+		*index = i;
+		if (i < 0)
+		{
+			return &gather_none;
+		}
+		return &m_subs->item(i).threshold;
+	}
+
+	void Logger::set_log_gather(const std::string& subsys, int gather)
+	{
+		m_subs->set_gather(subsys, gather);
+		notify_level_change(subsys);
+	}
+
+	void Logger::set_log_level(const std::string& subsys, int level)
+	{
+		m_subs->set_level(subsys, level);
+		notify_level_change(subsys);
+	}
+
+	void Logger::set_log_subsys(const std::string& subsys, int log_level, int gather_level)
+	{
+		m_subs->add(subsys, log_level, gather_level);
+		notify_level_change(subsys);
+	}
+
+	void Logger::set_log_level(int l)
+	{
+		m_log_level_ = l;
+		notify_level_change(std::string());
+	}
+
+	void Logger::set_gather_level(int g)
+	{
+		m_gather_level_ = g;
+		notify_level_change(std::string());
+	}
+
+	void Logger::add_level_observer(LevelObserver observer)
+	{
+		lock_guard l(observers_mutex_);
+		observers_.push_back(std::move(observer));
+	}
+
+	void Logger::notify_level_change(const std::string& subsys)
+	{
+		int level = m_log_level_;
+		int gather = m_gather_level_;
+		if (!subsys.empty())
+		{
+			int i = m_subs->find(subsys);
+			if (i < 0)
+			{
+				return;
+			}
+			const SubsysMap::Item& item = m_subs->item(i);
+			level = item.level;
+			gather = item.gather;
+		}
+		// called without the mutex: an observer may change levels or add observers itself
+		std::vector<LevelObserver> observers;
+		{
+			lock_guard l(observers_mutex_);
+			observers = observers_;
+		}
+		for (LevelObserver& observer : observers)
+		{
+			observer(subsys, level, gather);
+		}
+	}
+
+	int Logger::load_log_levels(const IniFile& ini, const std::string& section)
+	{
+		IniFile::Iterator iter = ini.Begin(section);
+		if (!iter)
+		{
+			return -1;
+		}
+		int applied = 0;
+		for (; iter; ++iter)
+		{
+			std::string key = iter.First();
+			while (!key.empty() && (key.back() == ' ' || key.back() == '\t'))
+			{
+				key.pop_back();
+			}
+			const char* value = iter.Second().c_str();
+			char* end = nullptr;
+			long level = strtol(value, &end, 10);
+			if (end == value)
+			{
+				std::cout << "log levels [" << section << "]: bad value for " << key << ": " << iter.Second() << std::endl;
+				continue;
+			}
+			long gather = level;
+			while (*end == ' ' || *end == '\t')
+			{
+				++end;
+			}
+			if (*end == ',')
+			{
+				gather = strtol(end + 1, nullptr, 10);
+			}
+			if (key == "log_level")
+			{
+				set_log_level((int)level);
+			}
+			else if (key == "gather_level")
+			{
+				set_gather_level((int)level);
+			}
+			else
+			{
+				set_log_subsys(key, (int)level, (int)gather);
+			}
+			++applied;
+		}
+		return applied;
+	}
+
+	int Logger::add_sink(std::unique_ptr<WriterImpl> sink, int level, size_t queue_bytes)
+	{
+		if (thread_.joinable() || !sink)
+		{
+			return -1;
+		}
+		std::unique_ptr<LogSink> s(new LogSink(nullptr, level, queue_bytes, false));
+		s->own(std::move(sink));
+		s->start();
+		sinks_.push_back(std::move(s));
+		return (int)(sinks_.size() - 1);
+	}
+	uint64_t Logger::get_sink_dropped(int sink) const
+	{
+		if (sink < 0 || (size_t)sink >= sinks_.size())
+		{
+			return 0;
+		}
+		return sinks_[sink]->dropped();
+	}
+	int Logger::set_async_print(size_t queue_bytes)
+	{
+		if (thread_.joinable())
+		{
+			return -1;
+		}
+		print_queue_bytes_ = queue_bytes;
+		return 0;
+	}
+	int Logger::set_flight_recorder(size_t slots, size_t slot_size, int level, const std::string& dump_path, bool catch_signals)
+	{
+		if (recorder_ || slots == 0 || dump_path.empty())
+		{
+			return -1;
+		}
+		recorder_ = new FlightRecorder(slots, slot_size, m_subs, dump_path);
+		g_flight_recorder.store(recorder_);
+		set_tiny_abort_hook(flight_recorder_dump);
+#ifndef UNI_WIN
+		if (catch_signals)
+		{
+			const int sigs[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+			for (int sig : sigs)
+			{
+				struct sigaction sa;
+				memset(&sa, 0, sizeof(sa));
+				sa.sa_sigaction = flight_recorder_on_signal;
+				sigemptyset(&sa.sa_mask);
+				sa.sa_flags = SA_SIGINFO;
+				::sigaction(sig, &sa, &g_old_sigactions[sig]);
+			}
+		}
+#endif // !UNI_WIN
+		// the subsystems have to let level through for it to be recorded
+		m_subs->set_recorder(level + 1);
+		return 0;
+	}
+	int Logger::dump_flight_recorder()
+	{
+		if (!recorder_)
+		{
+			return -1;
+		}
+		return recorder_->dump();
+	}
+	int Logger::set_thread_ring(size_t entries, OverflowPolicy policy)
+	{
+		lock_guard l(queue_entry_mutex_);
+		if (started_ || thread_.joinable())
+		{
+			return -1;
+		}
+		ring_entries_ = entries;
+		ring_policy_ = policy;
+		return 0;
+	}
+
+	int Logger::set_log_arena(size_t chunk_size, size_t chunks)
+	{
+		lock_guard l(queue_entry_mutex_);
+		if (started_ || thread_.joinable() || arena_)
+		{
+			return -1;
+		}
+		if (chunk_size == 0 || chunks == 0)
+		{
+			return -1;
+		}
+		arena_ = new LogArena(chunk_size, chunks);
+		return 0;
+	}
+
+	Logger::EntryRing* Logger::local_ring()
+	{
+		EntryRing* ring = logger_ring_holder.ring.get();
+		if (ring)
+		{
+			return ring;
+		}
+		logger_ring_holder.ring = std::make_shared<EntryRing>(ring_entries_);
+		lock_guard l(rings_mutex_);
+		rings_.push_back(logger_ring_holder.ring);
+		return logger_ring_holder.ring.get();
+	}
+
+	void Logger::submit_to_ring(ConcreteEntry&& e)
+	{
+		EntryRing* ring = local_ring();
+		while (!ring->push(std::move(e)))
+		{
+			if (ring_policy_ == OverflowPolicy::drop_newest)
+			{
+				dropped_entries_.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			if (ring_policy_ == OverflowPolicy::drop_oldest)
+			{
+				if (ring->pop(nullptr))
+				{
+					dropped_entries_.fetch_add(1, std::memory_order_relaxed);
+				}
+				continue;
+			}
+			blocked_producers_.fetch_add(1);
+			{
+				unique_lock l(queue_entry_mutex_);
+				while (!to_stop_ && !ring->push(std::move(e)))
+				{
+					queue_entry_cond_.wait(l);
+				}
+				if (to_stop_)
+				{
+					dropped_entries_.fetch_add(1, std::memory_order_relaxed);
+				}
+				else if (consumer_parked_.load())
+				{
+					// the consumer may have parked while we waited for the lock
+					flush_entry_cond_.notify_all();
+				}
+			}
+			blocked_producers_.fetch_sub(1);
+			return;
+		}
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (consumer_parked_.load(std::memory_order_relaxed))
+		{
+			lock_guard l(queue_entry_mutex_);
+			flush_entry_cond_.notify_all();
+		}
+	}
+
+	size_t Logger::drain_rings(EntryVector& t)
+	{
+		size_t drained = 0;
+		lock_guard l(rings_mutex_);
+		for (size_t i = 0; i < rings_.size();)
+		{
+			EntryRing* ring = rings_[i].get();
+			bool closed = ring->closed();
+			while (ring->pop(&t))
+			{
+				++drained;
+			}
+			if (closed && ring->empty())
+			{
+				rings_[i] = rings_.back();
+				rings_.pop_back();
+				continue;
+			}
+			++i;
+		}
+		return drained;
+	}
+
+	void Logger::add_rate_limit(LogRateLimit* limit)
+	{
+		lock_guard l(limits_mutex_);
+		limits_.push_back(limit);
+	}
+	void Logger::remove_rate_limit(LogRateLimit* limit)
+	{
+		{
+			lock_guard l(limits_mutex_);
+			limits_.erase(std::remove(limits_.begin(), limits_.end(), limit), limits_.end());
+		}
+		// a static call site goes away at exit before the logger stops, hand its counts over now
+		short prio = 0;
+		int subsys = 0;
+		uint64_t repeated = 0;
+		uint64_t suppressed = 0;
+		if (limit->take_pending(true, &prio, &subsys, &repeated, &suppressed))
+		{
+			{
+				lock_guard l(queue_entry_mutex_);
+				if (!started_)
+				{
+					return;
+				}
+			}
+			MutableEntry note(prio, subsys);
+			format_limit_note(note, repeated, suppressed);
+			submit_entry(std::move(note));
+		}
+	}
+	bool Logger::flush_rate_limits(bool all)
+	{
+		// written straight out on the logger thread, queueing them here could wait on itself
+		EntryVector t;
+		bool any = false;
+		{
+			lock_guard l(limits_mutex_);
+			any = !limits_.empty();
+			for (LogRateLimit* limit : limits_)
+			{
+				short prio = 0;
+				int subsys = 0;
+				uint64_t repeated = 0;
+				uint64_t suppressed = 0;
+				if (limit->take_pending(all, &prio, &subsys, &repeated, &suppressed))
+				{
+					MutableEntry note(prio, subsys);
+					format_limit_note(note, repeated, suppressed);
+					t.emplace_back(note);
+				}
+			}
+		}
+		if (!t.empty())
+		{
+			flush(t);
+		}
+		return any;
+	}
+
+	int Logger::start()
+	{
+		unique_lock l(queue_entry_mutex_);
+		if (started_ || thread_.joinable())
+		{
+			return -1;
+		}
+		thread_ = std::thread([this] {run(); });
+		queue_entry_cond_.wait(l, [this] {return started_; });
+		return ((!started_) ? -1 : 0);
+	}
+
+	void Logger::stop()
+	{
 		{
 			lock_guard l(queue_entry_mutex_);
 			if (!started_)
@@ -392,43 +1999,180 @@ namespace tiny
 		lock_guard l(queue_entry_mutex_);
 		started_ = false;
 		flush(new_entries_);
-		if (m_log_buf.size() > 0)
+		if (ring_entries_ > 0)
+		{
+			EntryVector t;
+			drain_rings(t);
+			flush(t);
+		}
+		flush_rate_limits(true);
+		write_log_buf();
+		for (auto& sink : sinks_)
+		{
+			sink->stop();
+		}
+		if (print_sink_)
 		{
-			if (writer_impl_.get() != nullptr)
+			print_sink_->stop();
+		}
+	}
+	void Logger::print_line(const stringview* parts, size_t count)
+	{
+		if (print_sink_)
+		{
+			print_sink_->push(parts, count);
+			return;
+		}
+		if (writer_impl_.get() == nullptr)
+		{
+			return;
+		}
+		if (count == 1)
+		{
+			writer_impl_->Print(parts[0].data(), parts[0].size());
+			return;
+		}
+		m_print_buf.clear();
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_print_buf.insert(m_print_buf.end(), parts[i].begin(), parts[i].end());
+		}
+		writer_impl_->Print(m_print_buf.data(), m_print_buf.size());
+	}
+	void Logger::route_sinks(short prio, const stringview* parts, size_t count)
+	{
+		for (auto& sink : sinks_)
+		{
+			if (prio <= sink->level())
+			{
+				sink->push(parts, count);
+			}
+		}
+	}
+	void Logger::write_log_buf()
+	{
+		if (m_pending.empty())
+		{
+			if (m_log_buf.size() > 0)
+			{
+				if (writer_impl_.get() != nullptr)
+				{
+					writer_impl_->Write(m_log_buf.data(), m_log_buf.size());
+				}
+				m_log_buf.resize(0);
+			}
+			return;
+		}
+		m_iov.clear();
+		size_t begin = 0;
+		for (const PendingPiece& p : m_pending)
+		{
+			if (p.buf_end > begin)
+			{
+				m_iov.push_back(stringview(m_log_buf.data() + begin, p.buf_end - begin));
+			}
+			m_iov.push_back(p.ext);
+			begin = p.buf_end;
+		}
+		if (m_log_buf.size() > begin)
+		{
+			m_iov.push_back(stringview(m_log_buf.data() + begin, m_log_buf.size() - begin));
+		}
+		if (writer_impl_.get() != nullptr)
+		{
+			writer_impl_->WriteV(m_iov.data(), m_iov.size());
+		}
+		for (const PendingPiece& p : m_pending)
+		{
+			LogArena::release(p.chunk);
+		}
+		m_pending.clear();
+		m_pending_bytes = 0;
+		m_log_buf.resize(0);
+	}
+	void Logger::run()
+	{
+		{
+			lock_guard l(queue_entry_mutex_);
+			started_ = true;
+			queue_entry_cond_.notify_all();
+			owner_ = std::this_thread::get_id();
+		}
+		if (ring_entries_ > 0)
+		{
+			run_rings();
+			return;
+		}
+		unique_lock l(queue_entry_mutex_);
+		while (!to_stop_)
+		{
+			if (new_entries_.empty())
 			{
-				writer_impl_->Write(m_log_buf.data(), m_log_buf.size());
+				const bool limited = flush_rate_limits(false);
+				write_log_buf();
+				unsigned idle_ms = (writer_impl_.get() != nullptr) ? writer_impl_->Idle() : 0;
+				if (limited && (idle_ms == 0 || idle_ms > 1000))
+				{
+					// come back for the rate limit counts of call sites that went quiet
+					idle_ms = 1000;
+				}
+				if (idle_ms > 0)
+				{
+					flush_entry_cond_.wait_for(l, std::chrono::milliseconds(idle_ms));
+				}
+				else
+				{
+					flush_entry_cond_.wait(l);
+				}
 			}
+			EntryVector t;
+			t.swap(new_entries_);
+			queue_entry_cond_.notify_all();
+			l.unlock();
+			flush(t);
+			l.lock();
 		}
 	}
-	void Logger::run()
+	void Logger::run_rings()
 	{
-		{
-			lock_guard l(queue_entry_mutex_);
-			started_ = true;
-			queue_entry_cond_.notify_all();
-			owner_ = std::this_thread::get_id();
-		}
-		unique_lock l(queue_entry_mutex_);
+		EntryVector t;
 		while (!to_stop_)
 		{
-			if (new_entries_.empty())
+			drain_rings(t);
+			if (t.empty())
 			{
-				if (m_log_buf.size() > 0)
+				const bool limited = flush_rate_limits(false);
+				write_log_buf();
+				unsigned idle_ms = (writer_impl_.get() != nullptr) ? writer_impl_->Idle() : 0;
+				if (limited && (idle_ms == 0 || idle_ms > 1000))
+				{
+					idle_ms = 1000;
+				}
+				unique_lock l(queue_entry_mutex_);
+				consumer_parked_.store(true);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (!to_stop_ && drain_rings(t) == 0)
 				{
-					if (writer_impl_.get() != nullptr)
+					if (idle_ms > 0)
+					{
+						flush_entry_cond_.wait_for(l, std::chrono::milliseconds(idle_ms));
+					}
+					else
 					{
-						writer_impl_->Write(m_log_buf.data(), m_log_buf.size());
+						flush_entry_cond_.wait(l);
 					}
-					m_log_buf.resize(0);
 				}
-				flush_entry_cond_.wait(l);
+				consumer_parked_.store(false);
+				continue;
+			}
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (blocked_producers_.load(std::memory_order_relaxed) > 0)
+			{
+				lock_guard l(queue_entry_mutex_);
+				queue_entry_cond_.notify_all();
 			}
-			EntryVector t;
-			t.swap(new_entries_);
-			queue_entry_cond_.notify_all();
-			l.unlock();
 			flush(t);
-			l.lock();
+			t.clear();
 		}
 	}
 	void Logger::flush(EntryVector& t)
@@ -441,6 +2185,12 @@ namespace tiny
 			auto subsys = e.m_subsys;
 			auto thread = e.m_thread;
 			auto str = e.strv();
+			if (e.m_format)
+			{
+				m_format_buf.clear();
+				e.m_format->format(str, m_format_buf);
+				str = stringview(m_format_buf.data(), m_format_buf.size());
+			}
 			bool should_log = false;
 			bool gather_log = false;
 			const SubsysMap::Item& item = m_subs->item(subsys);
@@ -460,40 +2210,64 @@ namespace tiny
 			should_log = (e.m_prio <= max_log_level);		//print
 			gather_log = (e.m_prio <= max_gather_level);
 
+			const bool in_arena = (e.in_arena() && !e.m_format);
 			const std::size_t cur = m_log_buf.size();
 			std::size_t used = 0;
-			const std::size_t allocated = e.size() + 200;
+			const std::size_t allocated = (in_arena ? 0 : str.size()) + item.name.size() + 200;
 			m_log_buf.resize(cur + allocated);
 
 			char* const start = m_log_buf.data();
 			char* pos = start + cur;
 
-			used += (std::size_t)stamp.snprintf_t(pos + used, allocated - used);
-			used += (std::size_t)snprintf(pos + used, allocated - used, " <%s> thread id(0x%lx), log level(%2d) ", item.name.c_str(), (unsigned long)thread, prio);
-			memcpy(pos + used, str.data(), str.size());
-			used += str.size();
+			used += m_header.format(pos + used, allocated - used, stamp, item.name, (unsigned long)thread, prio);
+			const std::size_t header = used;
+			if (!in_arena)
+			{
+				memcpy(pos + used, str.data(), str.size());
+				used += str.size();
+			}
 			pos[used] = '\0';
 			tiny_assert((used + 1 /* '\n' */) < allocated);
 
 			pos[used++] = '\n';
 
+			stringview line[3];
+			size_t parts = 1;
+			if (!in_arena)
+			{
+				line[0] = stringview(pos, used);
+			}
+			else
+			{
+				line[0] = stringview(pos, header);
+				line[1] = str;
+				line[2] = stringview(pos + header, 1);
+				parts = 3;
+			}
 			if (should_log)
 			{
-				if (writer_impl_.get() != nullptr)
-				{
-					writer_impl_->Print(pos, used);
-				}
+				print_line(line, parts);
+			}
+			if ((should_log || gather_log) && !sinks_.empty())
+			{
+				route_sinks(prio, line, parts);
 			}
 			if (gather_log)
 			{
 				m_log_buf.resize(cur + used);
-				if (m_log_buf.size() > MAX_LOG_BUF)
+				if (in_arena)
 				{
-					if (writer_impl_.get() != nullptr)
-					{
-						writer_impl_->Write(m_log_buf.data(), m_log_buf.size());
-					}
-					m_log_buf.resize(0);
+					// the message is written straight from the arena, m_log_buf keeps the header and '\n' around it
+					PendingPiece piece;
+					piece.buf_end = cur + header;
+					piece.ext = str;
+					piece.chunk = e.detach_chunk();
+					m_pending.push_back(piece);
+					m_pending_bytes += str.size();
+				}
+				if (m_log_buf.size() + m_pending_bytes > MAX_LOG_BUF)
+				{
+					write_log_buf();
 				}
 			}
 			else
@@ -503,4 +2277,495 @@ namespace tiny
 
 		}
 	}
-}
\ No newline at end of file
+
+	/*
+	*		class LogRotateWorker
+	*
+	*	Compresses rotated log segments and prunes old ones away from the logger thread.
+	*/
+
+	class LogRotateWorker : public Thread
+	{
+	public:
+		LogRotateWorker(const std::string& path, unsigned keep_files, const std::string& compress_cmd)
+			: path_(path)
+			, keep_files_(keep_files)
+			, stop_(false)
+		{
+			StringHelper::Split(compress_cmd, compress_args_, ' ');
+			compress_args_.erase(std::remove(compress_args_.begin(), compress_args_.end(), std::string()), compress_args_.end());
+		}
+		~LogRotateWorker() override
+		{
+			stop();
+		}
+	public:
+		void push(const std::string& segment)
+		{
+			lock_guard l(mutex_);
+			segments_.push_back(segment);
+			cond_.notify_one();
+		}
+	protected:
+		void on_stop() override
+		{
+			lock_guard l(mutex_);
+			stop_ = true;
+			cond_.notify_one();
+		}
+		void run() override
+		{
+			unique_lock l(mutex_);
+			for (;;)
+			{
+				while (segments_.empty() && !stop_)
+				{
+					cond_.wait(l);
+				}
+				if (segments_.empty())
+				{
+					break;
+				}
+				std::vector<std::string> segments;
+				segments.swap(segments_);
+				l.unlock();
+				prune();
+				for (const std::string& segment : segments)
+				{
+					if (File::Exists(segment))
+					{
+						compress(segment);
+					}
+				}
+				l.lock();
+			}
+		}
+	private:
+		void compress(const std::string& segment)
+		{
+#ifndef UNI_WIN
+			if (compress_args_.empty())
+			{
+				return;
+			}
+			std::vector<char*> argv;
+			for (std::string& arg : compress_args_)
+			{
+				argv.push_back(&arg[0]);
+			}
+			std::string file(segment);
+			argv.push_back(&file[0]);
+			argv.push_back(nullptr);
+			pid_t pid = 0;
+			int ret = posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ);
+			if (ret != 0)
+			{
+				std::cout << "compress log [" << segment << "] failed: " << cpp_strerror(ret) << std::endl;
+				return;
+			}
+			int status = 0;
+			while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			{
+			}
+#endif // !UNI_WIN
+		}
+		void prune()
+		{
+#ifndef UNI_WIN
+			if (keep_files_ == 0)
+			{
+				return;
+			}
+			std::string dir(".");
+			std::string prefix(path_);
+			size_t slash = path_.rfind(TINY_FILE_SLASH);
+			if (slash != std::string::npos)
+			{
+				dir = path_.substr(0, slash + 1);
+				prefix = path_.substr(slash + 1);
+			}
+			prefix.push_back('.');
+			// sort on "<yyyymmdd-hhmmss>[-nnn]" so the compressor's extension doesn't matter
+			std::vector<std::pair<std::string, std::string> > names;
+			DIR* d = opendir(dir.c_str());
+			if (!d)
+			{
+				return;
+			}
+			struct dirent* ent = nullptr;
+			while ((ent = readdir(d)) != nullptr)
+			{
+				std::string name(ent->d_name);
+				// only "<name>.<yyyymmdd-hhmmss>[...]", never the live file
+				if (name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0 && isdigit((unsigned char)name[prefix.size()]))
+				{
+					size_t ext = name.find('.', prefix.size());
+					names.push_back(std::make_pair(name.substr(prefix.size(), ext == std::string::npos ? std::string::npos : ext - prefix.size()), name));
+				}
+			}
+			closedir(d);
+			if (names.size() <= keep_files_)
+			{
+				return;
+			}
+			std::sort(names.begin(), names.end());
+			if (dir[dir.size() - 1] != TINY_FILE_SLASH)
+			{
+				dir.push_back(TINY_FILE_SLASH);
+			}
+			for (size_t i = 0; i < names.size() - keep_files_; ++i)
+			{
+				::unlink((dir + names[i].second).c_str());
+			}
+#endif // !UNI_WIN
+		}
+	private:
+		std::string path_;
+		unsigned keep_files_;
+		std::vector<std::string> compress_args_;
+		bool stop_;
+		std::mutex mutex_;
+		std::condition_variable cond_;
+		std::vector<std::string> segments_;
+	};
+
+	/*
+	* Renames the log at path to "<path>.<yyyymmdd-hhmmss>[-nnn]" after the time it was
+	* opened, returns the new name or an empty string when it could not be renamed.
+	*/
+	static std::string log_rotate_rename(const std::string& path, time_t opened)
+	{
+		struct tm bdt;
+		tm_localtime(&opened, &bdt);
+		char suffix[64];
+		snprintf(suffix, sizeof(suffix), ".%04d%02d%02d-%02d%02d%02d",
+			bdt.tm_year + 1900, bdt.tm_mon + 1, bdt.tm_mday,
+			bdt.tm_hour, bdt.tm_min, bdt.tm_sec);
+		std::string segment = path + suffix;
+		for (int i = 1; File::Exists(segment) || File::Exists(segment + ".gz"); ++i)
+		{
+			char seq[16];
+			snprintf(seq, sizeof(seq), "-%03d", i);
+			segment = path + suffix + seq;
+		}
+		if (::rename(path.c_str(), segment.c_str()) != 0)
+		{
+			std::cout << "rotate log [" << path << "] failed: " << cpp_strerror(errno) << std::endl;
+			return std::string();
+		}
+		return segment;
+	}
+
+	InnerLogWriterImpl::~InnerLogWriterImpl()
+	{
+		rotate_worker_.reset();
+	}
+	void InnerLogWriterImpl::rotate()
+	{
+		if (!File::Exists(file_.Path()))
+		{
+			return;
+		}
+		std::string segment = log_rotate_rename(file_.Path(), lastest_open_.seconds());
+		if (segment.empty())
+		{
+			return;
+		}
+		if (!rotate_worker_)
+		{
+			rotate_worker_.reset(new LogRotateWorker(file_.Path(), KEEP_FILES, "gzip"));
+			rotate_worker_->start();
+		}
+		rotate_worker_->push(segment);
+	}
+
+	/*
+	*		class AppendLogWriterImpl
+	*/
+
+	AppendLogWriterImpl::AppendLogWriterImpl(const std::string& path, size_t sync_bytes, unsigned sync_ms, bool print)
+		: path_(path)
+		, fd_(-1)
+		, sync_bytes_(sync_bytes)
+		, sync_ms_(sync_ms)
+		, print_(print)
+		, unsynced_(0)
+		, last_sync_(time_detail::mono_clock::now())
+		, rotate_bytes_(0)
+		, rotate_hourly_(false)
+		, keep_files_(0)
+		, file_size_(0)
+		, opened_at_(0)
+		, next_hour_(0)
+	{
+		if (path_.empty())
+		{
+			path_ = File::Current();
+			File::AppendFileSlash(path_);
+			path_.append("tiny_default.log");
+		}
+	}
+	AppendLogWriterImpl::~AppendLogWriterImpl()
+	{
+		if (fd_ >= 0 && (sync_bytes_ > 0 || sync_ms_ > 0))
+		{
+#ifndef UNI_WIN
+			::fdatasync(fd_);
+#else
+			::_commit(fd_);
+#endif // !UNI_WIN
+		}
+		close_file();
+		rotate_worker_.reset();
+	}
+	void AppendLogWriterImpl::set_rotation(size_t max_bytes, bool hourly, unsigned keep_files, const std::string& compress_cmd)
+	{
+		rotate_bytes_ = max_bytes;
+		rotate_hourly_ = hourly;
+		keep_files_ = keep_files;
+		compress_cmd_ = compress_cmd;
+		if (rotate_hourly_ && fd_ >= 0)
+		{
+			next_hour_ = utime_t(opened_at_, 0).round_to_hour().seconds() + 3600;
+		}
+	}
+	void AppendLogWriterImpl::Write(const char* data, size_t len)
+	{
+		stringview buf(data, len);
+		WriteV(&buf, 1);
+	}
+	void AppendLogWriterImpl::WriteV(const stringview* bufs, size_t count)
+	{
+		if (fd_ >= 0 && should_rotate())
+		{
+			rotate();
+		}
+		if (!open_file())
+		{
+			return;
+		}
+		size_t written = 0;
+#ifndef UNI_WIN
+		struct iovec iov[64];
+		size_t index = 0;
+		while (index < count)
+		{
+			int n = 0;
+			while (index < count && n < (int)(sizeof(iov) / sizeof(iov[0])))
+			{
+				iov[n].iov_base = (void*)bufs[index].data();
+				iov[n].iov_len = bufs[index].size();
+				++n;
+				++index;
+			}
+			struct iovec* pos = iov;
+			while (n > 0)
+			{
+				ssize_t ret = ::writev(fd_, pos, n);
+				if (ret < 0)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					std::cout << "write log [" << path_ << "] failed: " << cpp_strerror(errno) << std::endl;
+					close_file();
+					return;
+				}
+				written += (size_t)ret;
+				// drop what was written, a short write leaves the rest of the batch
+				while (n > 0 && (size_t)ret >= pos->iov_len)
+				{
+					ret -= pos->iov_len;
+					++pos;
+					--n;
+				}
+				if (n > 0)
+				{
+					pos->iov_base = (char*)pos->iov_base + ret;
+					pos->iov_len -= ret;
+				}
+			}
+		}
+#else
+		for (size_t i = 0; i < count; ++i)
+		{
+			const char* data = bufs[i].data();
+			size_t left = bufs[i].size();
+			while (left > 0)
+			{
+				int ret = ::_write(fd_, data, (unsigned)left);
+				if (ret <= 0)
+				{
+					close_file();
+					return;
+				}
+				data += ret;
+				left -= ret;
+				written += ret;
+			}
+		}
+#endif // !UNI_WIN
+		file_size_ += written;
+		sync_file(written);
+	}
+	void AppendLogWriterImpl::Print(const char* data, size_t len)
+	{
+		if (!print_)
+		{
+			return;
+		}
+#ifndef UNI_WIN
+		while (len > 0)
+		{
+			ssize_t ret = ::write(STDOUT_FILENO, data, len);
+			if (ret < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (ret <= 0)
+			{
+				return;
+			}
+			data += ret;
+			len -= ret;
+		}
+#else
+		std::cout << stringview(data, len);
+#endif // !UNI_WIN
+	}
+	bool AppendLogWriterImpl::open_file()
+	{
+		if (fd_ >= 0)
+		{
+			return true;
+		}
+#ifndef UNI_WIN
+		fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#else
+		fd_ = ::_open(path_.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#endif // !UNI_WIN
+		if (fd_ < 0)
+		{
+			std::cout << "open log [" << path_ << "] file failed: " << cpp_strerror(errno) << std::endl;
+			return false;
+		}
+		unsynced_ = 0;
+		last_sync_ = time_detail::mono_clock::now();
+		file_size_ = 0;
+#ifndef UNI_WIN
+		struct stat st;
+		if (::fstat(fd_, &st) == 0)
+#else
+		struct _stat st;
+		if (::_fstat(fd_, &st) == 0)
+#endif // !UNI_WIN
+		{
+			file_size_ = (size_t)st.st_size;
+		}
+		opened_at_ = time(nullptr);
+		if (rotate_hourly_)
+		{
+			next_hour_ = utime_t(opened_at_, 0).round_to_hour().seconds() + 3600;
+		}
+		return true;
+	}
+	bool AppendLogWriterImpl::should_rotate() const
+	{
+		if (rotate_bytes_ > 0 && file_size_ >= rotate_bytes_)
+		{
+			return true;
+		}
+		return (rotate_hourly_ && time(nullptr) >= next_hour_);
+	}
+	void AppendLogWriterImpl::rotate()
+	{
+		if (file_size_ == 0)
+		{
+			// nothing to keep, just start a new period
+			opened_at_ = time(nullptr);
+			next_hour_ = utime_t(opened_at_, 0).round_to_hour().seconds() + 3600;
+			return;
+		}
+		if (sync_bytes_ > 0 || sync_ms_ > 0)
+		{
+#ifndef UNI_WIN
+			::fdatasync(fd_);
+#else
+			::_commit(fd_);
+#endif // !UNI_WIN
+		}
+		close_file();
+
+		std::string segment = log_rotate_rename(path_, opened_at_);
+		if (segment.empty())
+		{
+			return;
+		}
+		if (!rotate_worker_)
+		{
+			rotate_worker_.reset(new LogRotateWorker(path_, keep_files_, compress_cmd_));
+			rotate_worker_->start();
+		}
+		rotate_worker_->push(segment);
+	}
+	void AppendLogWriterImpl::close_file()
+	{
+		if (fd_ < 0)
+		{
+			return;
+		}
+#ifndef UNI_WIN
+		::close(fd_);
+#else
+		::_close(fd_);
+#endif // !UNI_WIN
+		fd_ = -1;
+	}
+	void AppendLogWriterImpl::sync_file(size_t written)
+	{
+		if (sync_bytes_ == 0 && sync_ms_ == 0)
+		{
+			return;
+		}
+		unsynced_ += written;
+		bool sync = (sync_bytes_ > 0 && unsynced_ >= sync_bytes_);
+		time_detail::mono_clock::time_point now;
+		if (!sync && sync_ms_ > 0)
+		{
+			now = time_detail::mono_clock::now();
+			sync = ((now - last_sync_) >= std::chrono::milliseconds(sync_ms_));
+		}
+		if (!sync || unsynced_ == 0)
+		{
+			return;
+		}
+		sync_now((now == time_detail::mono_clock::time_point()) ? time_detail::mono_clock::now() : now);
+	}
+	void AppendLogWriterImpl::sync_now(time_detail::mono_clock::time_point now)
+	{
+#ifndef UNI_WIN
+		::fdatasync(fd_);
+#else
+		::_commit(fd_);
+#endif // !UNI_WIN
+		unsynced_ = 0;
+		last_sync_ = now;
+	}
+	unsigned AppendLogWriterImpl::Idle()
+	{
+		// the tail of a burst is otherwise only synced by the next write
+		if (fd_ < 0 || sync_ms_ == 0 || unsynced_ == 0)
+		{
+			return 0;
+		}
+		time_detail::mono_clock::time_point now = time_detail::mono_clock::now();
+		std::chrono::milliseconds elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_sync_);
+		if (elapsed.count() >= (long long)sync_ms_)
+		{
+			sync_now(now);
+			return 0;
+		}
+		return sync_ms_ - (unsigned)elapsed.count();
+	}
+}
@@ -4,7 +4,7 @@
 #include "tiny_logger.h"
 #include "tiny_sqlite3_helper.h"
 #define ldout(v)		dout_impl(v, tiny_sqlite3)
-#define lderr()				dout_impl(-1, tiny_sqlite3)
+#define lderr()				dout_limit_impl(-1, tiny_sqlite3, 10, 50)
 namespace tiny
 {
 	namespace db
@@ -4,10 +4,136 @@
 #include <Windows.h>
 #else
 #include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
 #endif // UNI_WIN
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <fstream>
+#ifndef MPOL_LOCAL
+#define MPOL_LOCAL 4
+#endif
+#endif // __linux__
 #include "tiny_assert.h"
+#include "tiny_string.h"
 namespace tiny
 {
+	/*
+	*	struct ThreadPlacement
+	*/
+	int ThreadPlacement::apply(int index) const
+	{
+		int ret = 0;
+		std::vector<int> allowed = cpus;
+		if (cpu_per_thread && index >= 0 && !cpus.empty())
+		{
+			allowed.assign(1, cpus[index % cpus.size()]);
+		}
+#ifdef __linux__
+		if (!name.empty())
+		{
+			std::string suffix = (index >= 0 ? "-" + std::to_string(index) : std::string());
+			std::string thread_name = name.substr(0, 15 - std::min<size_t>(suffix.size(), 15)) + suffix;
+			pthread_setname_np(pthread_self(), thread_name.c_str());
+		}
+		if (!allowed.empty())
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			for (int cpu : allowed)
+			{
+				if (cpu >= 0 && cpu < CPU_SETSIZE)
+				{
+					CPU_SET(cpu, &set);
+				}
+			}
+			int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+			if (r != 0)
+			{
+				std::cout << "pthread_setaffinity_np failed: " << cpp_strerror(r) << std::endl;
+				ret = -r;
+			}
+		}
+		if (numa_local && syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0) != 0)
+		{
+			int err = errno;
+			std::cout << "set_mempolicy(MPOL_LOCAL) failed: " << cpp_strerror(err) << std::endl;
+			ret = -err;
+		}
+		if (fifo_priority > 0)
+		{
+			struct sched_param param;
+			memset(&param, 0, sizeof(param));
+			param.sched_priority = fifo_priority;
+			int r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+			if (r != 0)
+			{
+				std::cout << "SCHED_FIFO priority " << fifo_priority << " failed: " << cpp_strerror(r) << std::endl;
+				ret = -r;
+			}
+		}
+#elif defined(UNI_WIN)
+		if (!allowed.empty())
+		{
+			DWORD_PTR mask = 0;
+			for (int cpu : allowed)
+			{
+				if (cpu >= 0 && cpu < (int)(sizeof(mask) * 8))
+				{
+					mask |= ((DWORD_PTR)1 << cpu);
+				}
+			}
+			if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0)
+			{
+				std::cout << "SetThreadAffinityMask failed: " << GetLastError() << std::endl;
+				ret = -1;
+			}
+		}
+		if (fifo_priority > 0 && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+		{
+			std::cout << "SetThreadPriority failed: " << GetLastError() << std::endl;
+			ret = -1;
+		}
+#endif // __linux__
+		return ret;
+	}
+	std::vector<int> ThreadPlacement::cpus_of_node(int node)
+	{
+		std::vector<int> result;
+#ifdef __linux__
+		// e.g. "0-3,8-11"
+		std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		std::string list;
+		if (!std::getline(in, list))
+		{
+			return result;
+		}
+		size_t pos = 0;
+		while (pos < list.size())
+		{
+			size_t end = list.find(',', pos);
+			if (end == std::string::npos)
+			{
+				end = list.size();
+			}
+			std::string range = list.substr(pos, end - pos);
+			size_t dash = range.find('-');
+			int first = atoi(range.c_str());
+			int last = (dash == std::string::npos ? first : atoi(range.c_str() + dash + 1));
+			for (int cpu = first; cpu <= last; ++cpu)
+			{
+				result.push_back(cpu);
+			}
+			pos = end + 1;
+		}
+#endif // __linux__
+		return result;
+	}
+
+	/*
+	*	class Thread
+	*/
 	Thread::~Thread()
 	{
 		tiny_assert(!thread_.joinable());
@@ -27,7 +153,7 @@ namespace tiny
 		{
 			return ret;
 		}
-		thread_ = std::thread([this] { owner_ = std::this_thread::get_id();  run(); owner_ = std::thread::id(); });
+		thread_ = std::thread([this] { owner_ = std::this_thread::get_id(); placement_.apply(); run(); owner_ = std::thread::id(); });
 		return on_started();
 	}
 	void Thread::stop()
@@ -73,26 +199,30 @@ namespace tiny
 	}
 	int ThreadStack::Create()
 	{
-		size_t size;
-		if (0 != OnCreate(size))
+		stack_lock.lock();
+		// before OnCreate, which rebuilds what running threads would still be using
+		if (started)
 		{
+			stack_lock.unlock();
 			return -1;
 		}
-		if (size == 0|| size==std::string::npos)
+		size_t size;
+		if (0 != OnCreate(size))
 		{
+			stack_lock.unlock();
 			return -1;
 		}
-		stack_lock.lock();
-		if (started)
+		if (size == 0|| size==std::string::npos)
 		{
 			stack_lock.unlock();
 			return -1;
 		}
 		threads.resize(size);
+		const ThreadPlacement where = thread_placement();
 		for (size_t i = 0; i < size; ++i)
 		{
 			std::function<void()> thread = add_thread(i);
-			threads[i] = std::thread(std::move(thread));
+			threads[i] = std::thread([where, i, thread] { where.apply((int)i); thread(); });
 		}
 		started = true;
 		stack_lock.unlock();